@@ -0,0 +1,300 @@
+#!/bin/bash
+#
+# Differential correctness and performance check of all the engines.
+#
+# Every engine and mode (gol, and pgol with several thread counts, in each
+# layout / update mode) is run on a set of boards, and its final board, previews
+# and per generation statistics are compared, bit for bit, to the serial reference
+# (gol in its default mode). The imbalance column of the statistics depends on
+# timing, so it isn't compared.
+#
+# Then check_pool.c steps simulations in all the modes concurrently on a single
+# shared pool, and a "pgol --serve" server is sent jobs by client.py (with inline
+# and with server side boards), and their results are compared to the reference too.
+#
+# Then the throughput of each engine is measured on a random board (the best of
+# $BENCHMARK_RUNS runs, to filter out noise), and compared to the baseline stored
+# in $BASELINE. The check fails if the throughput dropped by more than $THRESHOLD
+# percent. Since the baseline is machine specific, it isn't committed, and it's
+# (re)created by running with --update-baseline. Without it, only the
+# correctness checks gate the result, unless REQUIRE_BASELINE=1 (for machines
+# which should always have a baseline), which fails the check instead.
+#
+# Usage: [REQUIRE_BASELINE=1] ./check.sh [--update-baseline] [steps]
+#
+
+BASELINE=${BASELINE:-check_baseline.txt}
+THRESHOLD=${THRESHOLD:-20}
+BENCHMARK_BOARD="--random 1024 --density 0.5 --seed 1"
+BENCHMARK_STEPS=${BENCHMARK_STEPS:-20}
+BENCHMARK_RUNS=${BENCHMARK_RUNS:-3}
+REQUIRE_BASELINE=${REQUIRE_BASELINE:-0}
+
+UPDATE_BASELINE=0
+if [ "$1" == "--update-baseline" ]; then
+	UPDATE_BASELINE=1
+	shift
+fi
+STEPS=${1:-100}
+
+# Boards are given as arguments of gol/pgol.
+# The edge patterns are placed on the board's border.
+BOARDS=(
+	"glider8.bin"
+	"rpentomino.bin"
+	"simple2.bin"
+	"--size 64 -x 62 -y 0 glider.cells"
+	"--size 64 -x 0 -y 61 rpentomino.cells"
+	"--size 32 -x 29 -y 29 rpentomino.cells"
+	"--size 512 primer.cells"
+	"--random 256 --density 0.5 --seed 1"
+	"--random 128 --density 0.9 --seed 2"
+	"--random 64 --density 0.1 --seed 3"
+	"--random 8 --density 0.5 --seed 4"
+)
+MODES=("" "--tiled" "--in-place")
+# Modes of pgol only
+PARALLEL_MODES=("--balance" "--balance --tiled")
+THREADS=(1 2 3 4 7)
+
+WORK=$(mktemp -d)
+SERVER_PID=
+trap 'if [ -n "$SERVER_PID" ]; then kill $SERVER_PID; fi; rm -rf $WORK' EXIT
+
+# The public headers are included by host programs, so they must build on their
+# own, in C (also after <stdbool.h>) and in C++
+for LANGUAGE in c c++; do
+	printf '#include <stdbool.h>\n#include "gol_engine.h"\n#include "gol_pattern.h"\n#include "gol_server.h"\n' \
+			| gcc -Wall -fsyntax-only -x $LANGUAGE -I. - || exit 1
+done
+
+SOURCES="gol_engine.c gol_pattern.c gol_preview.c gol_trace.c"
+gcc -O2 gol.c $SOURCES -o $WORK/gol -pthread || exit 1
+gcc -O2 pgol.c $SOURCES gol_server.c -o $WORK/pgol -pthread || exit 1
+gcc -O2 check_pool.c $SOURCES -o $WORK/check_pool -pthread || exit 1
+
+FAILURES=0
+
+# Run an engine on a board, and compare the results to the reference ones.
+# Usage: check <name> <command...>
+check()
+{
+	NAME=$1
+	shift
+	"$@" --stats $WORK/stats.txt --output $WORK/board.bin > /dev/null
+	STATUS=$?
+	if [ $STATUS -ne 0 ]; then
+		echo "FAIL: $NAME (exit status $STATUS)"
+		FAILURES=$((FAILURES + 1))
+	elif ! cmp -s $WORK/board.bin $WORK/reference_board.bin; then
+		echo "FAIL: $NAME (final board differs)"
+		FAILURES=$((FAILURES + 1))
+	elif ! cmp -s <(cut -d' ' -f1-8 $WORK/stats.txt) <(cut -d' ' -f1-8 $WORK/reference_stats.txt); then
+		echo "FAIL: $NAME (statistics differ)"
+		FAILURES=$((FAILURES + 1))
+	fi
+}
+
+#
+# Correctness
+#
+
+CHECKS=0
+for BOARD in "${BOARDS[@]}"; do
+	$WORK/gol $BOARD $STEPS --stats $WORK/reference_stats.txt --output $WORK/reference_board.bin > /dev/null || exit 1
+	for MODE in "${MODES[@]}"; do
+		if [ -n "$MODE" ]; then
+			check "gol $MODE $BOARD" $WORK/gol $MODE $BOARD $STEPS
+			CHECKS=$((CHECKS + 1))
+		fi
+	done
+	for MODE in "${MODES[@]}" "${PARALLEL_MODES[@]}"; do
+		for THREAD_COUNT in "${THREADS[@]}"; do
+			check "pgol $MODE $BOARD ($THREAD_COUNT threads)" $WORK/pgol $MODE $BOARD $STEPS $THREAD_COUNT
+			CHECKS=$((CHECKS + 1))
+		done
+	done
+done
+
+# Boards which should be rejected (board dimensions must be powers of 2)
+INVALID_BOARDS=(
+	"--random 100 --density 0.5 --seed 1"
+	"--size 48 glider.cells"
+)
+
+# Run an engine on an invalid board, which it should reject with an error (rather than crash).
+# Usage: check_rejected <name> <command...>
+check_rejected()
+{
+	NAME=$1
+	shift
+	"$@" > /dev/null 2>&1
+	STATUS=$?
+	if [ $STATUS -ne 1 ]; then
+		echo "FAIL: $NAME (exit status $STATUS, expected an error)"
+		FAILURES=$((FAILURES + 1))
+	fi
+}
+
+for BOARD in "${INVALID_BOARDS[@]}"; do
+	check_rejected "gol $BOARD" $WORK/gol $BOARD $STEPS
+	check_rejected "pgol $BOARD" $WORK/pgol $BOARD $STEPS 2
+	CHECKS=$((CHECKS + 2))
+done
+
+# The previews are written to the current directory, so they're checked
+# on a random board (which doesn't need a path).
+PREVIEW_BOARD="--random 256 --density 0.5 --seed 5"
+PREVIEW_OPTIONS="--preview 13x7 --preview-every 7"
+mkdir $WORK/reference_previews
+(cd $WORK/reference_previews && $WORK/gol $PREVIEW_BOARD $PREVIEW_OPTIONS $STEPS > /dev/null) || exit 1
+
+# Run an engine with previews, and compare them to the reference ones.
+# Usage: check_previews <name> <command...>
+check_previews()
+{
+	NAME=$1
+	shift
+	rm -rf $WORK/previews
+	mkdir $WORK/previews
+	(cd $WORK/previews && "$@" $PREVIEW_OPTIONS > /dev/null)
+	STATUS=$?
+	if [ $STATUS -ne 0 ]; then
+		echo "FAIL: $NAME (exit status $STATUS)"
+		FAILURES=$((FAILURES + 1))
+	elif ! diff -rq $WORK/previews $WORK/reference_previews > /dev/null; then
+		echo "FAIL: $NAME (previews differ)"
+		FAILURES=$((FAILURES + 1))
+	fi
+}
+
+for MODE in "${MODES[@]}"; do
+	if [ -n "$MODE" ]; then
+		check_previews "gol $MODE previews" $WORK/gol $MODE $PREVIEW_BOARD $STEPS
+		CHECKS=$((CHECKS + 1))
+	fi
+done
+for MODE in "${MODES[@]}" "${PARALLEL_MODES[@]}"; do
+	check_previews "pgol $MODE previews" $WORK/pgol $MODE $PREVIEW_BOARD $STEPS 3
+	CHECKS=$((CHECKS + 1))
+done
+
+# Simulations in all the modes, stepped concurrently by a single shared pool
+if ! $WORK/check_pool $STEPS 3; then
+	FAILURES=$((FAILURES + 1))
+fi
+CHECKS=$((CHECKS + 1))
+
+# Server round trips, with the board sent by the client, and read by the server.
+# The boards are given as .bin files, since that's what client.py sends.
+SERVER_BOARDS=(
+	"glider8.bin"
+	"rpentomino.bin"
+	"--random 256 --density 0.5 --seed 1"
+)
+$WORK/pgol --serve $WORK/socket 3 &
+SERVER_PID=$!
+while [ ! -S $WORK/socket ] && kill -0 $SERVER_PID 2> /dev/null; do
+	sleep 0.1
+done
+
+# Run a job on the server, and compare its results to the reference ones.
+# Usage: check_server <name> <client arguments...>
+check_server()
+{
+	NAME=$1
+	shift
+	python3 client.py $WORK/socket "$@" $STEPS $WORK/board.bin --stats > $WORK/stats.txt
+	STATUS=$?
+	if [ $STATUS -ne 0 ]; then
+		echo "FAIL: $NAME (exit status $STATUS)"
+		FAILURES=$((FAILURES + 1))
+	elif ! cmp -s $WORK/board.bin $WORK/reference_board.bin; then
+		echo "FAIL: $NAME (final board differs)"
+		FAILURES=$((FAILURES + 1))
+	elif ! cmp -s <(grep -v '^Simulated' $WORK/stats.txt | cut -d' ' -f1-8) <(grep -v '^#' $WORK/reference_stats.txt | cut -d' ' -f1-8); then
+		echo "FAIL: $NAME (statistics differ)"
+		FAILURES=$((FAILURES + 1))
+	fi
+}
+
+# Note: every board is written to the same file, which also checks that
+# the server's board cache notices that the file changed.
+for BOARD in "${SERVER_BOARDS[@]}"; do
+	$WORK/gol $BOARD 0 --output $WORK/input_board.bin > /dev/null || exit 1
+	$WORK/gol $BOARD $STEPS --stats $WORK/reference_stats.txt --output $WORK/reference_board.bin > /dev/null || exit 1
+	check_server "server $BOARD" $WORK/input_board.bin
+	check_server "server --remote $BOARD" --remote $WORK/input_board.bin
+	CHECKS=$((CHECKS + 2))
+done
+kill $SERVER_PID
+wait $SERVER_PID 2> /dev/null
+SERVER_PID=
+echo "Ran $CHECKS checks of $STEPS steps, $FAILURES failed"
+
+#
+# Performance
+#
+
+# Print the best throughput (in cells per microsecond) of $BENCHMARK_RUNS runs of a command
+# Usage: measure <command...>
+measure()
+{
+	BEST=0
+	for RUN in $(seq $BENCHMARK_RUNS); do
+		MILLISECONDS=$("$@" | sed -n 's/^Simulated [0-9]* steps in \([0-9]*\) milliseconds.*/\1/p')
+		if [ -z "$MILLISECONDS" ]; then
+			continue
+		fi
+		if [ "$MILLISECONDS" -eq 0 ]; then
+			MILLISECONDS=1
+		fi
+		THROUGHPUT=$((1024 * 1024 * BENCHMARK_STEPS / (MILLISECONDS * 1000)))
+		if [ $THROUGHPUT -gt $BEST ]; then
+			BEST=$THROUGHPUT
+		fi
+	done
+	echo $BEST
+}
+
+THREAD_COUNT=$(nproc)
+RESULTS=$WORK/results.txt
+> $RESULTS
+for MODE in "${MODES[@]}" "${PARALLEL_MODES[@]}"; do
+	# e.g. "--balance --tiled" is named balance+tiled
+	MODE_NAME=$(echo $MODE | sed 's/--//g; s/ /+/g')
+	MODE_NAME=${MODE_NAME:-rows}
+	if [[ " ${MODES[@]} " == *" $MODE "* ]]; then
+		echo "gol:$MODE_NAME $(measure $WORK/gol $MODE $BENCHMARK_BOARD $BENCHMARK_STEPS)" >> $RESULTS
+	fi
+	echo "pgol:$MODE_NAME:$THREAD_COUNT $(measure $WORK/pgol $MODE $BENCHMARK_BOARD $BENCHMARK_STEPS $THREAD_COUNT)" >> $RESULTS
+done
+
+if [ $UPDATE_BASELINE -eq 1 ]; then
+	cp $RESULTS $BASELINE
+	echo "Updated $BASELINE:"
+	cat $BASELINE
+elif [ ! -f $BASELINE ] && [ "$REQUIRE_BASELINE" == "1" ]; then
+	echo "FAIL: there's no $BASELINE, and REQUIRE_BASELINE=1 (create it with --update-baseline)"
+	FAILURES=$((FAILURES + 1))
+elif [ ! -f $BASELINE ]; then
+	echo "WARNING: throughput check SKIPPED, there's no $BASELINE (create it with --update-baseline)" >&2
+	echo "Throughput (cells/us), not compared to any baseline:"
+	cat $RESULTS
+else
+	while read ENGINE THROUGHPUT; do
+		BASELINE_THROUGHPUT=$(sed -n "s/^$ENGINE \([0-9]*\)$/\1/p" $BASELINE)
+		if [ -z "$BASELINE_THROUGHPUT" ]; then
+			echo "$ENGINE: $THROUGHPUT cells/us (no baseline)"
+		elif [ $((THROUGHPUT * 100)) -lt $((BASELINE_THROUGHPUT * (100 - THRESHOLD))) ]; then
+			echo "FAIL: $ENGINE: $THROUGHPUT cells/us, regressed from $BASELINE_THROUGHPUT cells/us"
+			FAILURES=$((FAILURES + 1))
+		else
+			echo "$ENGINE: $THROUGHPUT cells/us (baseline $BASELINE_THROUGHPUT cells/us)"
+		fi
+	done < $RESULTS
+fi
+
+if [ $FAILURES -ne 0 ]; then
+	exit 1
+fi
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "common.h"
+#include "gol_engine.h"
+
+//
+// Concurrency check of a shared worker pool (run by check.sh).
+//
+// Simulations in all the layout / update modes are stepped at the same time,
+// each from its own thread, by a single WorkerPool. The final board and the
+// statistics of every generation of each one are compared to those of the
+// same board stepped serially.
+//
+
+//
+// Constants
+//
+
+#define USAGE "Usage: ./check_pool <steps> <threads>\n"
+#define DENSITY 0.5
+
+//
+// Structs
+//
+
+typedef struct Mode_t
+{
+	const char* name;
+	Layout layout;
+	bool is_in_place;
+	bool is_balanced;
+} Mode;
+
+typedef struct Job_t
+{
+	const Mode* mode;
+	int n;
+	unsigned long seed;
+	int steps;
+	WorkerPool* pool;
+	char* cells;
+	Stats* stats;
+	bool is_stepped;
+} Job;
+
+//
+// Globals
+//
+
+static const Mode modes[] = {
+	{"rows", LAYOUT_ROWS, FALSE, FALSE},
+	{"tiled", LAYOUT_TILES, FALSE, FALSE},
+	{"in-place", LAYOUT_ROWS, TRUE, FALSE},
+	{"balance", LAYOUT_ROWS, FALSE, TRUE},
+	{"balance+tiled", LAYOUT_TILES, FALSE, TRUE},
+};
+
+// Board dimensions, each simulated in every mode
+static const int sizes[] = {8, 64, 256};
+
+//
+// Function Declarations
+//
+
+static void* step_job(void* arg);
+static bool run_job(Job* job);
+static bool is_same_stats(const Stats* a, const Stats* b);
+
+//
+// Implementation
+//
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, USAGE);
+		return EXIT_FAILURE;
+	}
+	int steps = strtol(argv[1], NULL, 0);
+	int thread_count = strtol(argv[2], NULL, 0);
+	VERIFY(steps > 0 && thread_count > 0, "Invallid argument");
+
+	const int mode_count = sizeof(modes) / sizeof(modes[0]);
+	const int size_count = sizeof(sizes) / sizeof(sizes[0]);
+	const int job_count = mode_count * size_count;
+	Job* jobs = (Job*)malloc(job_count * sizeof(Job));
+	Job* references = (Job*)malloc(size_count * sizeof(Job));
+	pthread_t* threads = (pthread_t*)malloc(job_count * sizeof(pthread_t));
+	VERIFY(jobs != NULL && references != NULL && threads != NULL, "malloc jobs failed");
+
+	// The references are stepped serially, in the default mode
+	int i;
+	for (i = 0; i < size_count; ++i)
+	{
+		Job reference = {&modes[0], sizes[i], i + 1, steps, NULL, NULL, NULL, FALSE};
+		references[i] = reference;
+		VERIFY(run_job(&references[i]), "simulate reference failed");
+	}
+
+	WorkerPool* pool = gol_create_worker_pool(thread_count);
+	for (i = 0; i < job_count; ++i)
+	{
+		Job job = {&modes[i % mode_count], sizes[i / mode_count], i / mode_count + 1, steps, pool, NULL, NULL, FALSE};
+		jobs[i] = job;
+		PCHECK(pthread_create(&threads[i], NULL, step_job, &jobs[i]), "create thread failed");
+	}
+	for (i = 0; i < job_count; ++i)
+	{
+		PCHECK(pthread_join(threads[i], NULL), "join thread failed");
+	}
+	gol_destroy_worker_pool(pool);
+
+	int failures = 0;
+	for (i = 0; i < job_count; ++i)
+	{
+		const Job* job = &jobs[i];
+		const Job* reference = &references[i / mode_count];
+		int n = job->n;
+		if (!job->is_stepped) {
+			printf("FAIL: shared pool %s %d*%d (step failed)\n", job->mode->name, n, n);
+			failures += 1;
+		} else if (memcmp(job->cells, reference->cells, n * n) != 0) {
+			printf("FAIL: shared pool %s %d*%d (final board differs)\n", job->mode->name, n, n);
+			failures += 1;
+		} else {
+			int generation;
+			for (generation = 0; generation < steps; ++generation)
+			{
+				if (!is_same_stats(&job->stats[generation], &reference->stats[generation])) {
+					printf("FAIL: shared pool %s %d*%d (statistics differ)\n", job->mode->name, n, n);
+					failures += 1;
+					break;
+				}
+			}
+		}
+	}
+	for (i = 0; i < job_count; ++i)
+	{
+		free(jobs[i].cells);
+		free(jobs[i].stats);
+	}
+	for (i = 0; i < size_count; ++i)
+	{
+		free(references[i].cells);
+		free(references[i].stats);
+	}
+	free(threads);
+	free(references);
+	free(jobs);
+
+	printf("Ran %d concurrent simulations on a shared pool of %d threads, %d failed\n", job_count, thread_count, failures);
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void* step_job(void* arg)
+{
+	Job* job = (Job*)arg;
+	job->is_stepped = run_job(job);
+	return NULL;
+}
+
+// Simulate a job's board, and keep its final cells and the statistics of every generation.
+// Return FALSE if the simulation can't be created or stepped.
+static bool run_job(Job* job)
+{
+	// Note: the board is filled serially, so only the steps share the pool
+	Simulation* simulation = gol_create_random_simulation(job->n, DENSITY, job->seed, NULL);
+	if (simulation == NULL) {
+		return FALSE;
+	}
+	job->cells = (char*)malloc(job->n * job->n);
+	// Note: Stats are cache line aligned, which malloc doesn't guarantee
+	if (posix_memalign((void**)&job->stats, CACHE_LINE_SIZE, job->steps * sizeof(Stats)) != 0) {
+		job->stats = NULL;
+	}
+	bool is_stepped = job->cells != NULL && job->stats != NULL &&
+			gol_set_layout(simulation, job->mode->layout) &&
+			gol_set_in_place(simulation, job->mode->is_in_place) &&
+			gol_set_balanced(simulation, job->mode->is_balanced);
+	int i;
+	for (i = 0; i < job->steps && is_stepped; ++i)
+	{
+		is_stepped = gol_simulate_step(simulation, job->pool, &job->stats[i]);
+	}
+	if (is_stepped) {
+		gol_export_cells(simulation, job->cells);
+	}
+	gol_destroy_simulation(simulation);
+	return is_stepped;
+}
+
+// Note: the imbalance depends on timing, so it isn't compared
+static bool is_same_stats(const Stats* a, const Stats* b)
+{
+	return a->population == b->population &&
+			a->births == b->births &&
+			a->deaths == b->deaths &&
+			a->min_x == b->min_x &&
+			a->min_y == b->min_y &&
+			a->max_x == b->max_x &&
+			a->max_y == b->max_y;
+}
@@ -0,0 +1,51 @@
+import argparse
+import socket
+import sys
+
+
+def main():
+    args = parse_args()
+    run_job(args.socket, args.input, args.steps, args.output, args.stats, args.remote)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='submit a job to a "pgol --serve" server')
+    parser.add_argument('socket', help='server socket path')
+    parser.add_argument('input', help='input pattern file')
+    parser.add_argument('steps', type=int, help='number of steps to simulate')
+    parser.add_argument('output', type=argparse.FileType('wb'), help='output pattern file')
+    parser.add_argument('--stats', action='store_true', help='print per generation statistics')
+    parser.add_argument('--remote', action='store_true',
+                        help='let the server read (and cache) the input file, instead of sending it')
+    return parser.parse_args()
+
+
+def run_job(socket_path, input_path, steps, output, stats, remote):
+    connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    connection.connect(socket_path)
+    flag = ' stats' if stats else ''
+    if remote:
+        connection.sendall(('file %s %d%s\n' % (input_path, steps, flag)).encode())
+    else:
+        with open(input_path, 'rb') as input:
+            content = input.read()
+        n = int(len(content) ** 0.5 + 0.5)
+        connection.sendall(('board %d %d%s\n' % (n, steps, flag)).encode() + content)
+
+    response = connection.makefile('rb')
+    while True:
+        line = response.readline().decode()
+        if line.startswith('stats '):
+            sys.stdout.write(line[len('stats '):])
+        elif line.startswith('done '):
+            _, n, milliseconds = line.split()
+            n = int(n)
+            output.write(response.read(n * n))
+            print('Simulated %d steps in %s milliseconds' % (steps, milliseconds))
+            return
+        else:
+            exit('Error, %s' % (line.strip() or 'connection closed'))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,40 @@
+#ifndef COMMON_H_
+#define COMMON_H_
+
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+
+//
+// Macros
+//
+
+// Return number of elements in static array
+#define ARRAY_LENGTH(array) (sizeof(array)/sizeof(array[0]))
+// Exit with an error message
+#define ERROR(...) error(EXIT_FAILURE, errno, __VA_ARGS__)
+// Verify that a condition holds, else exit with an error.
+#define VERIFY(condition, ...) if (!(condition)) ERROR(__VA_ARGS__)
+// Verify that a pthread operation succeeds, else exit with an error.
+#define PCHECK(pthread_operation, ...)            \
+	do {                                          \
+		int _r = (pthread_operation);             \
+		if (_r != 0) {                            \
+			error(EXIT_FAILURE, _r, __VA_ARGS__); \
+		}                                         \
+	} while(0)
+
+//
+// Constants
+//
+
+typedef int bool;
+#define FALSE 0
+#define TRUE 1
+
+#define KILO 1024
+#define MEGA (KILO*KILO)
+
+#define CACHE_LINE_SIZE 64
+
+#endif /* COMMON_H_ */
@@ -2,5 +2,5 @@
 STEPS=${1:-1}
 INPUT_MATRIX=${2:-glider8.bin}
 
-gcc gol.c -o gol && ./gol $INPUT_MATRIX $STEPS
+gcc gol.c gol_engine.c gol_pattern.c gol_preview.c gol_trace.c -o gol -pthread && ./gol $INPUT_MATRIX $STEPS
 rm -f gol
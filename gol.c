@@ -1,74 +1,32 @@
 #include <stdio.h>
-#include <fcntl.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <time.h>
-#include <sys/time.h>
-#include <assert.h>
 #include <errno.h>
-#include <string.h>
 #include <stdlib.h>
-#include <error.h>
-
-//
-// Macros
-//
-
-// Return number of elements in static array
-#define ARRAY_LENGTH(array) (sizeof(array)/sizeof(array[0]))
-// Exit with an error message
-#define ERROR(...) error(EXIT_FAILURE, errno, __VA_ARGS__)
-// Verify that a condition holds, else exit with an error.
-#define VERIFY(condition, ...) if (!(condition)) ERROR(__VA_ARGS__)
+#include <limits.h>
+#include <getopt.h>
+#include "common.h"
+#include "gol_engine.h"
+#include "gol_pattern.h"
 
 //
 // Constants
 //
 
-typedef int bool;
-#define FALSE 0
-#define TRUE 1
-
-#define KILO 1024
-#define MEGA (KILO*KILO)
-
-//
-// Structs
-//
-
-typedef struct Matrix_t
-{
-	int n;
-	int** cols;
-} Matrix;
-
-//
-// Globals
-//
-
-
-Matrix _matrix1;
-Matrix _matrix2;
-Matrix* game_matrix = &_matrix1;
-Matrix* helper_matrix = &_matrix2;
-
-//
-// Function Declarations
-//
-
-unsigned long simulate(int steps);
-void simulate_step();
-void simulate_step_on_cell(Matrix* source, Matrix* dest, int x, int y);
-int count_alive_neighbors(const Matrix* matrix, int x, int y);
-bool is_alive(const Matrix* matrix, int x, int y);
-void load_matrix(Matrix* matrix, char* file_path);
-void print_matrix(const Matrix* matrix);
-void save_matrix(const Matrix* matrix, char* file_path);
-void create_matrix(Matrix* matrix, int n);
-void destroy_matrix(Matrix* matrix);
-unsigned int sqrt_(unsigned int n);
-int is_power_of_2 (unsigned int x);
+#define USAGE \
+	"Usage: ./gol [options] <file> <steps>\n" \
+	"       ./gol [options] --random <n> [--density <p>] [--seed <s>] <steps>\n" \
+	"Options:\n" \
+	"  --stats <stats file>    write per generation statistics\n" \
+	"  --output <output file>  save the final board\n" \
+	"  --size <n>              board dimension (a power of 2), for .cells and .rle pattern files\n" \
+	"  -x <offset>, -y <offset>  pattern offset, as in compile_pattern.py\n" \
+	"  --tiled                 store the board in Z-order tiles\n" \
+	"  --in-place              update the board in place (uses half the memory)\n" \
+	"  --trace <trace file>    write a Chrome trace (chrome://tracing, ui.perfetto.dev)\n" \
+	"  --preview <W>x<H>       write a WxH image of the board's density (preview_<generation>.pgm)\n" \
+	"  --preview-every <k>     write a preview every k generations (default: 100)\n"
+#define DEFAULT_DENSITY 0.5
+#define DEFAULT_PREVIEW_INTERVAL 100
+#define PREVIEW_FILE_FORMAT "preview_%06d.pgm"
 
 //
 // Implementation
@@ -76,263 +34,180 @@ int is_power_of_2 (unsigned int x);
 
 int main(int argc, char** argv)
 {
-	if (argc != 3) {
-		printf("Usage: ./gol <file> <steps>\n");
+	char* stats_path = NULL;
+	char* output_path = NULL;
+	char* trace_path = NULL;
+	int size = 0;
+	int offset_x = 0;
+	int offset_y = 0;
+	int random_size = 0;
+	double density = DEFAULT_DENSITY;
+	unsigned long seed = 0;
+	bool is_tiled = FALSE;
+	bool is_in_place = FALSE;
+	int preview_width = 0;
+	int preview_height = 0;
+	int preview_interval = DEFAULT_PREVIEW_INTERVAL;
+	struct option long_options[] = {
+		{"stats", required_argument, NULL, 's'},
+		{"output", required_argument, NULL, 'o'},
+		{"size", required_argument, NULL, 'n'},
+		{"random", required_argument, NULL, 'r'},
+		{"density", required_argument, NULL, 'd'},
+		{"seed", required_argument, NULL, 'e'},
+		{"tiled", no_argument, NULL, 't'},
+		{"in-place", no_argument, NULL, 'i'},
+		{"trace", required_argument, NULL, 'T'},
+		{"preview", required_argument, NULL, 'p'},
+		{"preview-every", required_argument, NULL, 'P'},
+		{0, 0, 0, 0}
+	};
+	int option;
+	errno = 0;
+	while ((option = getopt_long(argc, argv, "x:y:", long_options, NULL)) != -1)
+	{
+		switch (option) {
+		case 's':
+			stats_path = optarg;
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		case 'n':
+			size = strtol(optarg, NULL, 0);
+			VERIFY(errno == 0 && gol_can_step_in_pool(size), "Invallid argument given as --size (should be a power of 2)");
+			break;
+		case 'x':
+			offset_x = strtol(optarg, NULL, 0);
+			VERIFY(errno == 0 && offset_x >= 0, "Invallid argument given as -x");
+			break;
+		case 'y':
+			offset_y = strtol(optarg, NULL, 0);
+			VERIFY(errno == 0 && offset_y >= 0, "Invallid argument given as -y");
+			break;
+		case 'r':
+			random_size = strtol(optarg, NULL, 0);
+			VERIFY(errno == 0 && gol_can_step_in_pool(random_size), "Invallid argument given as --random (should be a power of 2)");
+			break;
+		case 'd':
+			density = strtod(optarg, NULL);
+			VERIFY(errno == 0 && density >= 0 && density <= 1, "Invallid argument given as --density");
+			break;
+		case 'e':
+			seed = strtoul(optarg, NULL, 0);
+			VERIFY(errno == 0, "Invallid argument given as --seed");
+			break;
+		case 't':
+			is_tiled = TRUE;
+			break;
+		case 'i':
+			is_in_place = TRUE;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		case 'p':
+			VERIFY(sscanf(optarg, "%dx%d", &preview_width, &preview_height) == 2
+					&& preview_width >= 1 && preview_height >= 1, "Invallid argument given as --preview");
+			break;
+		case 'P':
+			preview_interval = strtol(optarg, NULL, 0);
+			VERIFY(errno == 0 && preview_interval >= 1, "Invallid argument given as --preview-every");
+			break;
+		default:
+			printf(USAGE);
+			return EXIT_FAILURE;
+		}
+	}
+	int positional_count = random_size != 0 ? 1 : 2;
+	if (argc - optind != positional_count) {
+		printf(USAGE);
 		return EXIT_FAILURE;
 	}
 
-	char* file_path = argv[1];
+	char* file_path = random_size != 0 ? NULL : argv[optind];
 	errno = 0;
-	int steps = strtol(argv[2], NULL, 0);
+	int steps = strtol(argv[argc - 1], NULL, 0);
 	VERIFY(errno == 0 && steps >= 0, "Invallid argument given as <steps>");
 
-	load_matrix(game_matrix, file_path);
-	if (game_matrix->n == 0) {
-		fprintf(stderr, "Error, input file is empty\n");
-		exit(EXIT_FAILURE);
+	if (trace_path != NULL) {
+		gol_set_trace_thread_name("main");
+		gol_start_trace(trace_path);
 	}
-	create_matrix(helper_matrix, game_matrix->n);
 
-	unsigned long time_milliseconds = simulate(steps);
-	printf("Simulated %d steps in %lu milliseconds\n", steps, time_milliseconds);
-
-	//print_matrix(game_matrix);
-	//save_matrix(game_matrix, "result.bin");
-
-	destroy_matrix(helper_matrix);
-	destroy_matrix(game_matrix);
-
-	return EXIT_SUCCESS;
-}
-
-unsigned long simulate(int steps)
-{
-	assert(game_matrix != NULL);
-	assert(helper_matrix != NULL);
-	assert(game_matrix != helper_matrix);
-	assert(game_matrix->n == helper_matrix->n);
-
-	// Start time measurement
-	struct timeval start, end, diff;
-	VERIFY(gettimeofday(&start, NULL) == 0, "Error getting time");
-
-	int i;
-	for (i = 0; i < steps; ++i)
-	{
-		simulate_step();
+	FILE* stats_file = NULL;
+	if (stats_path != NULL) {
+		stats_file = fopen(stats_path, "w");
+		VERIFY(stats_file != NULL, "open stats file failed");
+		gol_write_stats_header(stats_file);
 	}
 
-	// End time measurement
-	VERIFY(gettimeofday(&end, NULL) == 0, "Error getting time");
-
-	// Return measurement
-	timersub(&end, &start, &diff);
-	unsigned long diff_useconds = 1000000 * diff.tv_sec + diff.tv_usec;
-	unsigned long diff_milliseconds = diff_useconds / 1000;
-	return diff_milliseconds;
-}
-
-void simulate_step()
-{
-	int x, y;
-	for (x = 0; x < game_matrix->n; ++x)
-	{
-		for (y = 0; y < game_matrix->n; ++y)
-		{
-			simulate_step_on_cell(game_matrix, helper_matrix, x, y);
+	Simulation* simulation;
+	if (random_size != 0) {
+		simulation = gol_create_random_simulation(random_size, density, seed, NULL);
+	} else if (gol_is_pattern_file(file_path)) {
+		if (size == 0) {
+			fprintf(stderr, "Error, --size is required for pattern files\n");
+			exit(EXIT_FAILURE);
 		}
+		simulation = gol_create_simulation_from_pattern(file_path, size, offset_x, offset_y);
+	} else {
+		simulation = gol_create_simulation_from_file(file_path);
 	}
-
-	// Swap game and helper matrices
-	Matrix* temp = game_matrix;
-	game_matrix = helper_matrix;
-	helper_matrix = temp;
-}
-
-void simulate_step_on_cell(Matrix* source, Matrix* dest, int x, int y)
-{
-	int alive_neighbors = count_alive_neighbors(source, x, y);
-	if (is_alive(source, x, y)) {
-		if (alive_neighbors < 2 || alive_neighbors > 3) {
-			// Kill cell
-			dest->cols[x][y] = 0;
-		} else {
-			// Keep alive
-			dest->cols[x][y] = 1;
-		}
-	} else /* Cell is dead */ {
-		if (alive_neighbors == 3) {
-			// Revive cell
-			dest->cols[x][y] = 1;
+	if (simulation == NULL) {
+		if (file_path == NULL) {
+			fprintf(stderr, "Error, can't allocate the board\n");
 		} else {
-			// Keep dead
-			dest->cols[x][y] = 0;
+			fprintf(stderr, "Error, can't read a board from %s\n", file_path);
 		}
+		exit(EXIT_FAILURE);
 	}
-}
-
-int count_alive_neighbors(const Matrix* matrix, int x, int y)
-{
-	int alive_neighbors = 0;
-	int i, j;
-	for (i = x - 1; i <= x + 1; ++i)
-	{
-		for (j = y - 1; j <= y + 1; ++j)
-		{
-			if (i < 0 || i >= matrix->n
-					|| j < 0 || j >= matrix->n
-					|| (i == x && j == y)) {
-				continue;
-			}
-			if (is_alive(matrix, i, j)) {
-				alive_neighbors += 1;
-			}
-		}
+	if (is_tiled && !gol_set_layout(simulation, LAYOUT_TILES)) {
+		fprintf(stderr, "Error, --tiled requires a power of 2 board dimension\n");
+		exit(EXIT_FAILURE);
 	}
-	return alive_neighbors;
-}
-
-bool is_alive(const Matrix* matrix, int x, int y)
-{
-	return matrix->cols[x][y] == 1;
-}
-
-void load_matrix(Matrix* matrix, char* file_path)
-{
-	int fd = open(file_path, O_RDONLY);
-	VERIFY(fd != -1, "open input file failed");
-
-	struct stat file_stat;
-	VERIFY(fstat(fd, &file_stat) == 0, "fstat on input file failed");
-
-	int n = sqrt_(file_stat.st_size);
-	VERIFY(n * n == file_stat.st_size || !is_power_of_2(n), "input file length is not a power of 4");
-
-	create_matrix(matrix, n);
-
-	char* buffer = (char*)malloc(MEGA);
-	VERIFY(buffer != NULL, "malloc buffer failed");
-	int x, y;
-	int i = 0;
-	int bytes_read = 0;
-	for (x = 0; x < n; ++x)
-	{
-		for (y = 0; y < n; ++y)
-		{
-			if (i == bytes_read) {
-				bytes_read = read(fd, buffer, MEGA);
-				VERIFY(bytes_read != -1, "read from input failed");
-				if (bytes_read == 0) {
-					// Note: this shouldn't happen because we verified the file size.
-					fprintf(stderr, "Error, input ended prematurely.\n");
-					exit(EXIT_FAILURE);
-				}
-				i = 0;
-			}
-			matrix->cols[x][y] = buffer[i] == '\0' ? 0 : 1;
-			i += 1;
-		}
+	if (is_in_place && !gol_set_in_place(simulation, TRUE)) {
+		fprintf(stderr, "Error, --in-place can't be used with --tiled\n");
+		exit(EXIT_FAILURE);
 	}
 
-	free(buffer);
-	close(fd);
-}
-
-//Note: this is for debugging purposes only
-void print_matrix(const Matrix* matrix)
-{
-	char* buffer = (char*)malloc(matrix->n + 2);
-	VERIFY(buffer != NULL, "malloc buffer failed");
-	int x, y;
-	for (x = 0; x < matrix->n; ++x)
-	{
-		for (y = 0; y < matrix->n; ++y)
-		{
-			buffer[y] = matrix->cols[x][y] ? 'O' : '.';
-		}
-		buffer[matrix->n] = '\n';
-		buffer[matrix->n + 1] = '\0';
-		VERIFY(write(STDOUT_FILENO, buffer, matrix->n + 2), "print matrix failed");
+	PreviewWriter* previews = NULL;
+	if (preview_width != 0 && !gol_can_preview(gol_get_size(simulation), preview_width, preview_height)) {
+		fprintf(stderr, "Error, --preview must fit on the board, with up to %d cells per pixel\n", INT_MAX);
+		exit(EXIT_FAILURE);
 	}
-	free(buffer);
-}
-
-//Note: this is for debugging purposes only
-void save_matrix(const Matrix* matrix, char* file_path)
-{
-	int fd = creat(file_path, 0666);
-	VERIFY(fd != -1, "open output file failed");
-
-	char* buffer = (char*)malloc(matrix->n);
-	VERIFY(buffer != NULL, "malloc buffer failed");
-	int x, y;
-	for (x = 0; x < matrix->n; ++x)
-	{
-		for (y = 0; y < matrix->n; ++y)
-		{
-			buffer[y] = matrix->cols[x][y];
-		}
-		VERIFY(write(fd, buffer, matrix->n), "write to output failed");
+	if (preview_width != 0) {
+		previews = gol_create_preview_writer(PREVIEW_FILE_FORMAT, gol_get_size(simulation),
+				preview_width, preview_height, preview_interval);
 	}
-	free(buffer);
-
-	close(fd);
-}
 
-void create_matrix(Matrix* matrix, int n)
-{
-	matrix->n = n;
-	matrix->cols = (int**)malloc(sizeof(int*) * n);
-	VERIFY(matrix->cols != NULL, "malloc failed");
-	int i;
-	for (i = 0; i < n; ++i)
-	{
-		matrix->cols[i] = (int*)malloc(sizeof(int) * n);
-		VERIFY(matrix->cols[i] != NULL, "malloc failed");
+	Histogram latencies;
+	gol_reset_histogram(&latencies);
+	long time_milliseconds = gol_simulate(simulation, NULL, steps, stats_file, &latencies, previews);
+	if (time_milliseconds < 0) {
+		fprintf(stderr, "Error, simulation step failed (out of memory)\n");
+		exit(EXIT_FAILURE);
 	}
-}
+	printf("Simulated %d steps in %ld milliseconds\n", steps, time_milliseconds);
+	gol_print_latency_summary(stdout, "Step latency", &latencies);
 
-void destroy_matrix(Matrix* matrix)
-{
-	int i;
-	for (i = 0; i < matrix->n; ++i)
-	{
-		free(matrix->cols[i]);
+	//gol_print_simulation(simulation);
+	if (output_path != NULL && !gol_save_simulation(simulation, output_path)) {
+		fprintf(stderr, "Error, can't write the board to %s\n", output_path);
+		exit(EXIT_FAILURE);
 	}
-	free(matrix->cols);
-}
 
-int is_power_of_2 (unsigned int x)
-{
-	// Note: taken from www.exploringbinary.com/ten-ways-to-check-if-an-integer-is-a-power-of-two-in-c
-	return ((x != 0) && ((x & (~x + 1)) == x));
-}
+	if (previews != NULL) {
+		gol_destroy_preview_writer(previews);
+	}
 
-// Note: taken from http:unsigned int/stackoverflow.com/a/1101217
-// This is used instead of the standard sqrt(),
-// because the standard math sqrt requires linking with libmath.
-unsigned int sqrt_(unsigned int n)
-{
-	unsigned int op  = n;
-	unsigned int res = 0;
-	unsigned int one = 1uL << 30; // The second-to-top bit is set: use 1u << 14 for uint16_t type; use 1uL<<30 for uint32_t type
+	if (stats_file != NULL) {
+		VERIFY(fclose(stats_file) == 0, "close stats file failed");
+	}
 
+	gol_destroy_simulation(simulation);
 
-    // "one" starts at the highest power of four <= than the argument.
-    while (one > op)
-    {
-        one >>= 2;
-    }
+	gol_stop_trace();
 
-    while (one != 0)
-    {
-        if (op >= res + one)
-        {
-            op = op - (res + one);
-            res = res +  2 * one;
-        }
-        res >>= 1;
-        one >>= 2;
-    }
-    return res;
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,1875 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <error.h>
+#include <pthread.h>
+#include "common.h"
+#include "gol_engine.h"
+#include "gol_trace.h"
+
+//
+// Structs
+//
+
+typedef struct Matrix_t
+{
+	int n;
+	Layout layout;
+	int** cols;     // LAYOUT_ROWS: the rows of cells
+	int* tiles;     // LAYOUT_TILES: the tiles in Z-order, each one's cells row after row
+	int tile_shift; // LAYOUT_TILES: log2 of the tile dimension
+} Matrix;
+
+//
+// Constants
+//
+
+// Number of row bands per worker when filling a random board
+#define RANDOM_BANDS_PER_THREAD 4
+// Dimension of a tile (of LAYOUT_TILES), which is also the dimension of
+// the leaf tasks of a step. A tile of ints is a whole number of cache lines.
+#define TILE_SIZE 32
+// Number of runs of leaves (of about equal cost) per worker, in a balanced step
+#define BALANCED_CHUNKS_PER_THREAD 4
+
+//
+// Structs
+//
+
+typedef enum Operation_t
+{
+	OPERATION_STEP,        // Simulate the task's cells one generation
+	OPERATION_FILL_RANDOM, // Fill the task's cells randomly
+	OPERATION_STEP_IN_PLACE, // Simulate the task's band of rows one generation, in place
+	OPERATION_STEP_CHUNK,  // Simulate the task's run of leaves (in Z-order) one generation
+} Operation;
+
+// Names of the operations' leaf tasks in traces
+static const char* OPERATION_NAMES[] = {"step block", "fill random rows", "step band in place", "step chunk"};
+
+// A task which completes once all its child tasks complete.
+// Nodes are updated by the workers that complete the children,
+// so each one is padded to a cache line.
+typedef struct TaskNode_t
+{
+	int pending_children;
+	struct TaskNode_t* parent; // NULL for the root of a round
+} __attribute__((aligned(CACHE_LINE_SIZE))) TaskNode;
+
+typedef struct Task_t
+{
+	Simulation* simulation;
+	Operation operation;
+	int x;
+	int y;
+	int dx;
+	int dy;
+	int node;          // OPERATION_STEP: index of the task in the quadrant tree
+	TaskNode* parent;  // Completed when the task completes
+	int band;          // OPERATION_STEP_IN_PLACE: index of the band's row buffers
+	int first_leaf;    // OPERATION_STEP_CHUNK: Z-order index of the chunk's first leaf
+	int leaves_count;  // OPERATION_STEP_CHUNK: number of leaves in the chunk
+} Task;
+
+#define TASKS_PER_BLOCK (MEGA/sizeof(Task))
+
+typedef struct TaskQueue_t {
+	Task** task_blocks;
+	int blocks_count;
+	int capacity;
+	int first_task_index;
+	int task_count;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty_cond;
+} TaskQueue;
+
+// Rows of the previous generation, kept by a band of an in place step.
+// above and below are copies of the rows around the band (which other bands
+// overwrite concurrently), and previous and current roll over the band's own rows.
+typedef struct RowBuffers_t
+{
+	int* above;
+	int* below;
+	int* previous;
+	int* current;
+} RowBuffers;
+
+// A worker's partial statistics of a round (padded to a cache line, like Stats)
+typedef struct WorkerStats_t
+{
+	Stats stats;
+	uint64_t busy_time; // Nanoseconds spent on the round's leaf tasks
+} __attribute__((aligned(CACHE_LINE_SIZE))) WorkerStats;
+
+typedef struct Worker_t
+{
+	WorkerPool* pool;
+	int index;
+} Worker;
+
+struct WorkerPool_t
+{
+	int thread_count;
+	pthread_t* threads;
+	Worker* workers;
+	TaskQueue tasks;
+	bool should_worker_continue;
+};
+
+struct Simulation_t
+{
+	Matrix _matrix1;
+	Matrix _matrix2;
+	Matrix* game_matrix;
+	Matrix* helper_matrix;  // Allocated on the first step (and never when in place)
+	bool has_helper_matrix;
+	int generation;
+	int leaf_size; // Dimension of the leaf tasks of a step
+
+	// State of the current round of tasks, when executed by a worker pool.
+	// task_nodes[0] is the root of the round, and the rest are the quadrant tree
+	// of a step, in heap order (the children of quadrant q are 4q+1 to 4q+4).
+	// Only quadrants which are split have nodes.
+	TaskNode* task_nodes;
+	int task_nodes_count;
+	bool is_step_complete;
+	pthread_cond_t step_complete_cond;
+	pthread_mutex_t step_mutex;
+	// Partial statistics, one per worker (NULL if not gathering statistics)
+	WorkerStats* thread_stats;
+	int thread_stats_count;
+	bool should_gather_stats;
+	// Parameters of OPERATION_FILL_RANDOM
+	uint64_t random_seed;
+	uint64_t random_threshold;
+	// Row buffers of OPERATION_STEP_IN_PLACE, one RowBuffers per band
+	bool is_in_place;
+	RowBuffers* row_buffers;
+	int row_buffers_count;
+	// Cost (nanoseconds) of each leaf in the previous generation, in Z-order,
+	// by which the leaves are split into OPERATION_STEP_CHUNK tasks
+	bool is_balanced;
+	uint64_t* leaf_costs;
+	int leaf_costs_count;
+	// The counts of the preview requested for the next step (NULL if none),
+	// and the pixel of each row (as an offset into counts) and of each column
+	int* preview_counts;
+	int preview_width;
+	int preview_height;
+	int* preview_rows;
+	int* preview_columns;
+	// Partial counts of the preview, one per worker, each preview_stride ints apart
+	int* thread_previews;
+	int thread_previews_count;
+	int preview_stride;
+};
+
+//
+// Function Declarations
+//
+
+static void simulate_step_serially(Simulation* simulation, Stats* stats, int* preview);
+static bool simulate_step_in_pool(Simulation* simulation, WorkerPool* pool, Stats* stats);
+static bool execute_round(Simulation* simulation, WorkerPool* pool, const Task* tasks, int tasks_count);
+static bool prepare_task_nodes(Simulation* simulation, int nodes_count);
+static void complete_child(Simulation* simulation, TaskNode* node);
+static Simulation* allocate_simulation(Matrix* matrix);
+static void fill_random_rows(Simulation* simulation, int x, int dx);
+static bool simulate_step_in_place(Simulation* simulation, WorkerPool* pool);
+static bool prepare_row_buffers(Simulation* simulation, int bands_count);
+static void simulate_step_on_band(Simulation* simulation, int band, int x, int dx, Stats* stats, int* preview);
+static void simulate_step_on_row(const int* above, const int* row, const int* below, int* dest, int x, int n, Stats* stats);
+static bool simulate_step_balanced(Simulation* simulation, WorkerPool* pool);
+static bool prepare_leaf_costs(Simulation* simulation, int leaves_count);
+static void simulate_step_on_chunk(Simulation* simulation, int first_leaf, int leaves_count, Stats* stats, int* preview);
+static bool prepare_thread_previews(Simulation* simulation, int thread_count);
+static void add_to_preview(const Simulation* simulation, const Matrix* matrix, int x, int y, int dx, int dy, int* counts);
+static bool ensure_helper_matrix(Simulation* simulation);
+static uint64_t hash_cell(uint64_t seed, uint64_t index);
+static void simulate_step_on_block(Simulation* simulation, int x, int y, int dx, int dy, Stats* stats, int* preview);
+static void simulate_step_on_tile(Matrix* source, Matrix* dest, int x, int y, Stats* stats);
+static bool simulate_step_on_cell(Matrix* source, Matrix* dest, int x, int y);
+static void reset_stats(Stats* stats);
+static void update_stats(Stats* stats, int x, int y, bool was_alive, bool alive);
+static void merge_stats(Stats* stats, const Stats* other);
+static int count_alive_neighbors(const Matrix* matrix, int x, int y);
+static bool is_alive(const Matrix* matrix, int x, int y);
+static int open_board_file(const char* file_path, int* n);
+static bool load_matrix(Matrix* matrix, const char* file_path);
+static bool create_matrix(Matrix* matrix, int n, Layout layout);
+static void clear_matrix(Matrix* matrix);
+static void copy_matrix(Matrix* dest, const Matrix* source);
+static void destroy_matrix(Matrix* matrix);
+static inline int* get_cell_pointer(const Matrix* matrix, int x, int y);
+static inline size_t get_morton_index(unsigned int x, unsigned int y);
+static inline uint64_t spread_bits(uint64_t bits);
+static inline unsigned int compact_bits(uint64_t bits);
+static unsigned int sqrt_(unsigned int n);
+static int is_power_of_2 (unsigned int x);
+
+static void init_queue(TaskQueue* queue, int capacity);
+static void uninit_queue(TaskQueue* queue);
+static void grow_queue(TaskQueue* queue);
+static void lock_queue(TaskQueue* queue);
+static void unlock_queue(TaskQueue* queue);
+static bool is_queue_empty(const TaskQueue* queue);
+static Task* get_task(const TaskQueue* queue, int index);
+static Task* first_task(const TaskQueue* queue);
+static void enqueue_task(TaskQueue* queue, const Task* task);
+static void dequeue_task(TaskQueue* queue, Task* task);
+static void* execute_tasks(void* arg);
+static bool execute_task(TaskQueue* queue, const Task* task, Stats* stats, int* preview);
+
+//
+// Implementation
+//
+
+WorkerPool* gol_create_worker_pool(int thread_count)
+{
+	assert(thread_count >= 1);
+	WorkerPool* pool = (WorkerPool*)malloc(sizeof(*pool));
+	VERIFY(pool != NULL, "malloc worker pool failed");
+	pool->thread_count = thread_count;
+	pool->should_worker_continue = TRUE;
+	init_queue(&pool->tasks, TASKS_PER_BLOCK);
+
+	pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * thread_count);
+	VERIFY(pool->threads != NULL, "malloc threads failed");
+	pool->workers = (Worker*)malloc(sizeof(Worker) * thread_count);
+	VERIFY(pool->workers != NULL, "malloc workers failed");
+	int i;
+	for (i = 0; i < thread_count; ++i)
+	{
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+		PCHECK(pthread_create(&pool->threads[i], NULL, execute_tasks, &pool->workers[i]), "create thread failed");
+	}
+	return pool;
+}
+
+void gol_destroy_worker_pool(WorkerPool* pool)
+{
+	// Signal the workers to finish
+	// (if we wouldn't do this then we'd be unable to uninit_queue)
+	lock_queue(&pool->tasks);
+	pool->should_worker_continue = FALSE;
+	unlock_queue(&pool->tasks);
+	//Note: pthread_cond_broadcast wasn't mentioned in the recitation,
+	// so this code is disabled, and pthread_cond_signal is iterated instead.
+	//
+	//PCHECK(pthread_cond_broadcast(&pool->tasks.not_empty_cond), "condition broadcast failed");
+	int i;
+	for (i = 0; i < pool->thread_count; ++i)
+	{
+		PCHECK(pthread_cond_signal(&pool->tasks.not_empty_cond), "condition signal failed");
+	}
+	// Wait for them to actually finish
+	for (i = 0; i < pool->thread_count; ++i)
+	{
+		PCHECK(pthread_join(pool->threads[i], NULL), "thread join failed");
+	}
+
+	uninit_queue(&pool->tasks);
+	free(pool->workers);
+	free(pool->threads);
+	free(pool);
+}
+
+int gol_get_thread_count(const WorkerPool* pool)
+{
+	return pool->thread_count;
+}
+
+Simulation* gol_create_simulation(int n)
+{
+	if (n < 1) {
+		return NULL;
+	}
+	Matrix matrix;
+	if (!create_matrix(&matrix, n, LAYOUT_ROWS)) {
+		return NULL;
+	}
+	clear_matrix(&matrix);
+	return allocate_simulation(&matrix);
+}
+
+// Create a simulation of the matrix's cells (the simulation owns the matrix from now on).
+// Return NULL, and destroy the matrix, if the simulation can't be allocated.
+static Simulation* allocate_simulation(Matrix* matrix)
+{
+	Simulation* simulation = (Simulation*)malloc(sizeof(*simulation));
+	if (simulation == NULL) {
+		destroy_matrix(matrix);
+		return NULL;
+	}
+	int n = matrix->n;
+	simulation->game_matrix = &simulation->_matrix1;
+	simulation->helper_matrix = &simulation->_matrix2;
+	*simulation->game_matrix = *matrix;
+	simulation->has_helper_matrix = FALSE;
+	simulation->generation = 0;
+	simulation->leaf_size = n < TILE_SIZE ? n : TILE_SIZE;
+
+	simulation->task_nodes = NULL;
+	simulation->task_nodes_count = 0;
+	simulation->is_step_complete = FALSE;
+	PCHECK(pthread_mutex_init(&simulation->step_mutex, NULL), "init mutex failed");
+	PCHECK(pthread_cond_init(&simulation->step_complete_cond, NULL), "init condition variable failed");
+	simulation->thread_stats = NULL;
+	simulation->thread_stats_count = 0;
+	simulation->should_gather_stats = FALSE;
+	simulation->random_seed = 0;
+	simulation->random_threshold = 0;
+	simulation->is_in_place = FALSE;
+	simulation->row_buffers = NULL;
+	simulation->row_buffers_count = 0;
+	simulation->is_balanced = FALSE;
+	simulation->leaf_costs = NULL;
+	simulation->leaf_costs_count = 0;
+	simulation->preview_counts = NULL;
+	simulation->preview_width = 0;
+	simulation->preview_height = 0;
+	simulation->preview_rows = NULL;
+	simulation->preview_columns = NULL;
+	simulation->thread_previews = NULL;
+	simulation->thread_previews_count = 0;
+	simulation->preview_stride = 0;
+	return simulation;
+}
+
+Simulation* gol_create_simulation_from_buffer(const char* buffer, int n)
+{
+	if (buffer == NULL) {
+		return NULL;
+	}
+	Simulation* simulation = gol_create_simulation(n);
+	if (simulation != NULL) {
+		gol_import_cells(simulation, buffer);
+	}
+	return simulation;
+}
+
+Simulation* gol_create_simulation_from_file(const char* file_path)
+{
+	// Note: the simulation takes the loaded matrix (so there's never a second matrix)
+	Matrix matrix;
+	uint64_t span_start = gol_begin_span();
+	bool is_loaded = load_matrix(&matrix, file_path);
+	gol_end_span("load_matrix", span_start);
+	if (!is_loaded) {
+		return NULL;
+	}
+	return allocate_simulation(&matrix);
+}
+
+// The cells are filled in row bands by the pool's workers.
+// Each cell's value is a hash of the seed and the cell's index (a counter based
+// random generator), so the board doesn't depend on how the work was split.
+Simulation* gol_create_random_simulation(int n, double density, unsigned long seed, WorkerPool* pool)
+{
+	assert(0 <= density && density <= 1);
+	if (n < 1) {
+		return NULL;
+	}
+	Matrix matrix;
+	if (!create_matrix(&matrix, n, LAYOUT_ROWS)) {
+		return NULL;
+	}
+	uint64_t span_start = gol_begin_span();
+	Simulation* simulation = allocate_simulation(&matrix);
+	if (simulation == NULL) {
+		return NULL;
+	}
+	simulation->random_seed = seed;
+	// A cell is alive if the top 53 bits of its hash are below density * 2^53
+	simulation->random_threshold = (uint64_t)(density * (double)(1ULL << 53));
+
+	if (pool == NULL) {
+		fill_random_rows(simulation, 0, n);
+		gol_end_span("create_random_simulation", span_start);
+		return simulation;
+	}
+
+	int bands_count = pool->thread_count * RANDOM_BANDS_PER_THREAD;
+	if (bands_count > n) {
+		bands_count = n;
+	}
+	Task* tasks = (Task*)malloc(sizeof(Task) * bands_count);
+	if (tasks == NULL) {
+		gol_destroy_simulation(simulation);
+		return NULL;
+	}
+	int i;
+	for (i = 0; i < bands_count; ++i)
+	{
+		int first_row = (long)n * i / bands_count;
+		int last_row = (long)n * (i + 1) / bands_count;
+		Task task = {simulation, OPERATION_FILL_RANDOM, first_row, 0, last_row - first_row, n, 0, NULL, 0, 0, 0};
+		tasks[i] = task;
+	}
+	bool is_filled = execute_round(simulation, pool, tasks, bands_count);
+	free(tasks);
+	gol_end_span("create_random_simulation", span_start);
+	if (!is_filled) {
+		gol_destroy_simulation(simulation);
+		return NULL;
+	}
+	return simulation;
+}
+
+void gol_destroy_simulation(Simulation* simulation)
+{
+	PCHECK(pthread_cond_destroy(&simulation->step_complete_cond), "destroy condition variable failed");
+	PCHECK(pthread_mutex_destroy(&simulation->step_mutex), "destroy mutex failed");
+	free(simulation->thread_stats);
+	prepare_row_buffers(simulation, 0);
+	free(simulation->leaf_costs);
+	free(simulation->task_nodes);
+	free(simulation->preview_rows);
+	free(simulation->preview_columns);
+	free(simulation->thread_previews);
+	if (simulation->has_helper_matrix) {
+		destroy_matrix(simulation->helper_matrix);
+	}
+	destroy_matrix(simulation->game_matrix);
+	free(simulation);
+}
+
+bool gol_set_layout(Simulation* simulation, Layout layout)
+{
+	Matrix* game_matrix = simulation->game_matrix;
+	Matrix* helper_matrix = simulation->helper_matrix;
+	if (game_matrix->layout == layout) {
+		return TRUE;
+	}
+	int n = game_matrix->n;
+	if (layout == LAYOUT_TILES && (!is_power_of_2(n) || simulation->is_in_place)) {
+		return FALSE;
+	}
+
+	uint64_t span_start = gol_begin_span();
+	// Note: the helper matrix is freed first, so only two matrices exist at any time
+	// (it's allocated again on the next step)
+	if (simulation->has_helper_matrix) {
+		destroy_matrix(helper_matrix);
+		simulation->has_helper_matrix = FALSE;
+	}
+	if (!create_matrix(helper_matrix, n, layout)) {
+		gol_end_span("set_layout", span_start);
+		return FALSE;
+	}
+	copy_matrix(helper_matrix, game_matrix);
+	destroy_matrix(game_matrix);
+
+	// The converted cells are in the helper matrix now
+	simulation->game_matrix = helper_matrix;
+	simulation->helper_matrix = game_matrix;
+	gol_end_span("set_layout", span_start);
+	return TRUE;
+}
+
+bool gol_set_in_place(Simulation* simulation, bool is_in_place)
+{
+	if (is_in_place && simulation->game_matrix->layout != LAYOUT_ROWS) {
+		return FALSE;
+	}
+	simulation->is_in_place = is_in_place;
+	if (is_in_place && simulation->has_helper_matrix) {
+		destroy_matrix(simulation->helper_matrix);
+		simulation->has_helper_matrix = FALSE;
+	}
+	return TRUE;
+}
+
+bool gol_can_step_in_pool(int n)
+{
+	return is_power_of_2(n);
+}
+
+bool gol_set_balanced(Simulation* simulation, bool is_balanced)
+{
+	if (is_balanced && !is_power_of_2(simulation->game_matrix->n)) {
+		return FALSE;
+	}
+	simulation->is_balanced = is_balanced;
+	return TRUE;
+}
+
+Layout gol_get_layout(const Simulation* simulation)
+{
+	return simulation->game_matrix->layout;
+}
+
+int gol_get_size(const Simulation* simulation)
+{
+	return simulation->game_matrix->n;
+}
+
+int gol_get_generation(const Simulation* simulation)
+{
+	return simulation->generation;
+}
+
+bool gol_get_cell(const Simulation* simulation, int x, int y)
+{
+	assert(0 <= x && x < gol_get_size(simulation));
+	assert(0 <= y && y < gol_get_size(simulation));
+	return is_alive(simulation->game_matrix, x, y);
+}
+
+void gol_set_cell(Simulation* simulation, int x, int y, bool alive)
+{
+	assert(0 <= x && x < gol_get_size(simulation));
+	assert(0 <= y && y < gol_get_size(simulation));
+	*get_cell_pointer(simulation->game_matrix, x, y) = alive ? 1 : 0;
+}
+
+void gol_import_cells(Simulation* simulation, const char* buffer)
+{
+	Matrix* matrix = simulation->game_matrix;
+	int x, y;
+	for (x = 0; x < matrix->n; ++x)
+	{
+		for (y = 0; y < matrix->n; ++y)
+		{
+			*get_cell_pointer(matrix, x, y) = buffer[x * matrix->n + y] == '\0' ? 0 : 1;
+		}
+	}
+	simulation->generation = 0;
+}
+
+void gol_export_cells(const Simulation* simulation, char* buffer)
+{
+	const Matrix* matrix = simulation->game_matrix;
+	int x, y;
+	for (x = 0; x < matrix->n; ++x)
+	{
+		for (y = 0; y < matrix->n; ++y)
+		{
+			buffer[x * matrix->n + y] = *get_cell_pointer(matrix, x, y);
+		}
+	}
+}
+
+bool gol_save_simulation(const Simulation* simulation, const char* file_path)
+{
+	const Matrix* matrix = simulation->game_matrix;
+	char* buffer = (char*)malloc(matrix->n);
+	if (buffer == NULL) {
+		return FALSE;
+	}
+	int fd = creat(file_path, 0666);
+	if (fd == -1) {
+		free(buffer);
+		return FALSE;
+	}
+
+	uint64_t span_start = gol_begin_span();
+	bool is_saved = TRUE;
+	int x, y;
+	for (x = 0; x < matrix->n && is_saved; ++x)
+	{
+		for (y = 0; y < matrix->n; ++y)
+		{
+			buffer[y] = *get_cell_pointer(matrix, x, y);
+		}
+		is_saved = write(fd, buffer, matrix->n) == matrix->n;
+	}
+	free(buffer);
+
+	is_saved = close(fd) == 0 && is_saved;
+	gol_end_span("save_matrix", span_start);
+	return is_saved;
+}
+
+//Note: this is for debugging purposes only
+void gol_print_simulation(const Simulation* simulation)
+{
+	const Matrix* matrix = simulation->game_matrix;
+	char* buffer = (char*)malloc(matrix->n + 2);
+	VERIFY(buffer != NULL, "malloc buffer failed");
+	int x, y;
+	for (x = 0; x < matrix->n; ++x)
+	{
+		for (y = 0; y < matrix->n; ++y)
+		{
+			buffer[y] = *get_cell_pointer(matrix, x, y) ? 'O' : '.';
+		}
+		buffer[matrix->n] = '\n';
+		buffer[matrix->n + 1] = '\0';
+		VERIFY(write(STDOUT_FILENO, buffer, matrix->n + 2), "print matrix failed");
+	}
+	free(buffer);
+}
+
+long gol_simulate(Simulation* simulation, WorkerPool* pool, int steps, FILE* stats_file, Histogram* latencies, PreviewWriter* previews)
+{
+	// Start time measurement
+	uint64_t start = gol_get_time_ns();
+
+	Stats stats;
+	int i;
+	for (i = 0; i < steps; ++i)
+	{
+		uint64_t step_start = gol_get_time_ns();
+		uint64_t span_start = gol_begin_span();
+		bool is_preview_step = previews != NULL
+				&& (simulation->generation + 1) % gol_get_preview_interval(previews) == 0;
+		if (is_preview_step && !gol_request_preview(simulation, gol_get_preview_buffer(previews),
+				gol_get_preview_width(previews), gol_get_preview_height(previews))) {
+			return -1;
+		}
+		if (!gol_simulate_step(simulation, pool, stats_file != NULL ? &stats : NULL)) {
+			return -1;
+		}
+		if (is_preview_step) {
+			gol_submit_preview(previews, simulation->generation);
+		}
+		gol_end_span("generation", span_start);
+		if (latencies != NULL) {
+			gol_record_value(latencies, gol_get_time_ns() - step_start);
+		}
+		if (stats_file != NULL) {
+			gol_write_stats(stats_file, simulation->generation, &stats);
+		}
+	}
+
+	// End time measurement
+	uint64_t end = gol_get_time_ns();
+
+	// Return measurement
+	long diff_milliseconds = (end - start) / 1000000;
+	return diff_milliseconds;
+}
+
+bool gol_request_preview(Simulation* simulation, int* counts, int width, int height)
+{
+	int n = simulation->game_matrix->n;
+	if (!gol_can_preview(n, width, height)) {
+		return FALSE;
+	}
+	if (simulation->preview_rows == NULL || simulation->preview_width != width || simulation->preview_height != height) {
+		free(simulation->preview_rows);
+		free(simulation->preview_columns);
+		simulation->preview_rows = (int*)malloc(sizeof(int) * n);
+		simulation->preview_columns = (int*)malloc(sizeof(int) * n);
+		if (simulation->preview_rows == NULL || simulation->preview_columns == NULL) {
+			free(simulation->preview_rows);
+			free(simulation->preview_columns);
+			simulation->preview_rows = NULL;
+			simulation->preview_columns = NULL;
+			return FALSE;
+		}
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			simulation->preview_rows[i] = (int)((long)i * height / n) * width;
+			simulation->preview_columns[i] = (long)i * width / n;
+		}
+		simulation->preview_width = width;
+		simulation->preview_height = height;
+	}
+	memset(counts, 0, sizeof(int) * width * height);
+	simulation->preview_counts = counts;
+	return TRUE;
+}
+
+// Note: all the buffers a step needs are allocated before any cell is changed,
+// so a step that fails leaves the simulation as it was.
+bool gol_simulate_step(Simulation* simulation, WorkerPool* pool, Stats* stats)
+{
+	if (simulation->is_in_place) {
+		if (pool == NULL) {
+			if (!prepare_row_buffers(simulation, 1)) {
+				return FALSE;
+			}
+			if (stats != NULL) {
+				reset_stats(stats);
+			}
+			simulate_step_on_band(simulation, 0, 0, simulation->game_matrix->n, stats, simulation->preview_counts);
+		} else if (!simulate_step_in_pool(simulation, pool, stats)) {
+			return FALSE;
+		}
+		simulation->preview_counts = NULL;
+		simulation->generation += 1;
+		return TRUE;
+	}
+
+	if (!ensure_helper_matrix(simulation)) {
+		return FALSE;
+	}
+	assert(simulation->game_matrix != simulation->helper_matrix);
+	assert(simulation->game_matrix->n == simulation->helper_matrix->n);
+
+	if (pool == NULL) {
+		simulate_step_serially(simulation, stats, simulation->preview_counts);
+	} else if (!simulate_step_in_pool(simulation, pool, stats)) {
+		return FALSE;
+	}
+	simulation->preview_counts = NULL;
+
+	// Swap game and helper matrices
+	Matrix* temp = simulation->game_matrix;
+	simulation->game_matrix = simulation->helper_matrix;
+	simulation->helper_matrix = temp;
+	simulation->generation += 1;
+	return TRUE;
+}
+
+// Note: preview is the counts of the requested preview (NULL if none)
+static void simulate_step_serially(Simulation* simulation, Stats* stats, int* preview)
+{
+	Matrix* game_matrix = simulation->game_matrix;
+	Matrix* helper_matrix = simulation->helper_matrix;
+	int x, y;
+	if (game_matrix->layout == LAYOUT_TILES) {
+		// Go over the matrix tile by tile
+		if (stats != NULL) {
+			reset_stats(stats);
+		}
+		int tile_size = 1 << game_matrix->tile_shift;
+		int tiles_per_row = game_matrix->n / tile_size;
+		for (x = 0; x < tiles_per_row; ++x)
+		{
+			for (y = 0; y < tiles_per_row; ++y)
+			{
+				simulate_step_on_tile(game_matrix, helper_matrix, x * tile_size, y * tile_size, stats);
+				if (preview != NULL) {
+					add_to_preview(simulation, helper_matrix, x * tile_size, y * tile_size, tile_size, tile_size, preview);
+				}
+			}
+		}
+	} else if (stats == NULL) {
+		for (x = 0; x < game_matrix->n; ++x)
+		{
+			for (y = 0; y < game_matrix->n; ++y)
+			{
+				simulate_step_on_cell(game_matrix, helper_matrix, x, y);
+			}
+			if (preview != NULL) {
+				add_to_preview(simulation, helper_matrix, x, 0, 1, game_matrix->n, preview);
+			}
+		}
+	} else {
+		reset_stats(stats);
+		for (x = 0; x < game_matrix->n; ++x)
+		{
+			for (y = 0; y < game_matrix->n; ++y)
+			{
+				bool was_alive = is_alive(game_matrix, x, y);
+				bool alive = simulate_step_on_cell(game_matrix, helper_matrix, x, y);
+				update_stats(stats, x, y, was_alive, alive);
+			}
+			if (preview != NULL) {
+				add_to_preview(simulation, helper_matrix, x, 0, 1, game_matrix->n, preview);
+			}
+		}
+	}
+}
+
+// Each worker accumulates partial statistics (and preview counts) of the cells
+// it simulated, and these are merged once all the workers are done.
+// Return FALSE (before any cell is changed) if the board dimension isn't
+// a power of 2, or the step's buffers can't be allocated.
+static bool simulate_step_in_pool(Simulation* simulation, WorkerPool* pool, Stats* stats)
+{
+	int i;
+	// Note: the quadrant tree (see prepare_task_nodes) only fits power of 2 boards,
+	// and overruns task_nodes otherwise, so this isn't left to an assert.
+	if (!gol_can_step_in_pool(simulation->game_matrix->n)) {
+		return FALSE;
+	}
+	simulation->should_gather_stats = stats != NULL;
+	if (simulation->preview_counts != NULL && !prepare_thread_previews(simulation, pool->thread_count)) {
+		return FALSE;
+	}
+	if (stats != NULL) {
+		if (simulation->thread_stats_count < pool->thread_count) {
+			free(simulation->thread_stats);
+			simulation->thread_stats = NULL;
+			simulation->thread_stats_count = 0;
+			WorkerStats* thread_stats;
+			// Note: malloc doesn't guarantee cache line alignment
+			if (posix_memalign((void**)&thread_stats, CACHE_LINE_SIZE, sizeof(WorkerStats) * pool->thread_count) != 0) {
+				return FALSE;
+			}
+			simulation->thread_stats = thread_stats;
+			simulation->thread_stats_count = pool->thread_count;
+		}
+		for (i = 0; i < pool->thread_count; ++i)
+		{
+			reset_stats(&simulation->thread_stats[i].stats);
+			simulation->thread_stats[i].busy_time = 0;
+		}
+	}
+
+	bool is_stepped;
+	if (simulation->is_in_place) {
+		is_stepped = simulate_step_in_place(simulation, pool);
+	} else if (simulation->is_balanced) {
+		is_stepped = simulate_step_balanced(simulation, pool);
+	} else {
+		int n = simulation->game_matrix->n;
+		int leaves_per_row = n / simulation->leaf_size;
+		Task task = {simulation, OPERATION_STEP, 0, 0, n, n, 0, NULL, 0, 0, 0};
+		// The quadrants above the leaves are a third of the leaves
+		is_stepped = prepare_task_nodes(simulation, 1 + (leaves_per_row * leaves_per_row - 1) / 3)
+				&& execute_round(simulation, pool, &task, 1);
+	}
+	if (!is_stepped) {
+		return FALSE;
+	}
+
+	if (stats != NULL) {
+		reset_stats(stats);
+		uint64_t total_busy_time = 0;
+		uint64_t max_busy_time = 0;
+		for (i = 0; i < pool->thread_count; ++i)
+		{
+			merge_stats(stats, &simulation->thread_stats[i].stats);
+			uint64_t busy_time = simulation->thread_stats[i].busy_time;
+			total_busy_time += busy_time;
+			if (busy_time > max_busy_time) {
+				max_busy_time = busy_time;
+			}
+		}
+		if (total_busy_time != 0) {
+			stats->imbalance = (double)max_busy_time * pool->thread_count / total_busy_time;
+		}
+	}
+
+	if (simulation->preview_counts != NULL) {
+		int pixels_count = simulation->preview_width * simulation->preview_height;
+		for (i = 0; i < pool->thread_count; ++i)
+		{
+			const int* thread_preview = &simulation->thread_previews[i * simulation->preview_stride];
+			int j;
+			for (j = 0; j < pixels_count; ++j)
+			{
+				simulation->preview_counts[j] += thread_preview[j];
+			}
+		}
+	}
+	return TRUE;
+}
+
+// Allocate (and zero) partial preview counts for thread_count workers.
+// Return FALSE if they can't be allocated.
+static bool prepare_thread_previews(Simulation* simulation, int thread_count)
+{
+	int pixels_count = simulation->preview_width * simulation->preview_height;
+	// Round up to whole cache lines, so workers don't share cache lines
+	int stride = (sizeof(int) * pixels_count + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE / sizeof(int);
+	if (simulation->thread_previews_count < thread_count || simulation->preview_stride != stride) {
+		free(simulation->thread_previews);
+		simulation->thread_previews = NULL;
+		simulation->thread_previews_count = 0;
+		int* thread_previews;
+		// Note: malloc doesn't guarantee cache line alignment
+		if (posix_memalign((void**)&thread_previews, CACHE_LINE_SIZE, sizeof(int) * stride * thread_count) != 0) {
+			return FALSE;
+		}
+		simulation->thread_previews = thread_previews;
+		simulation->thread_previews_count = thread_count;
+		simulation->preview_stride = stride;
+	}
+	memset(simulation->thread_previews, 0, sizeof(int) * stride * thread_count);
+	return TRUE;
+}
+
+// Add the alive cells of a block of the matrix to the counts of a preview.
+// Note: each row of the block must be contiguous (at most a row of a tile, with LAYOUT_TILES)
+static void add_to_preview(const Simulation* simulation, const Matrix* matrix, int x, int y, int dx, int dy, int* counts)
+{
+	const int* columns = &simulation->preview_columns[y];
+	int i, j;
+	for (i = x; i < x + dx; ++i)
+	{
+		const int* row = get_cell_pointer(matrix, i, y);
+		int* pixels = &counts[simulation->preview_rows[i]];
+		for (j = 0; j < dy; ++j)
+		{
+			// Note: cells are always 0 or 1, so they can be summed
+			pixels[columns[j]] += row[j];
+		}
+	}
+}
+
+// The board is split into a band of rows per worker. Before the bands are
+// simulated, the rows around each band are copied, since their neighbor bands
+// overwrite them. This is done here, as it's only a couple of rows per band.
+static bool simulate_step_in_place(Simulation* simulation, WorkerPool* pool)
+{
+	Matrix* matrix = simulation->game_matrix;
+	int n = matrix->n;
+	int bands_count = pool->thread_count < n ? pool->thread_count : n;
+	if (!prepare_row_buffers(simulation, bands_count)) {
+		return FALSE;
+	}
+
+	Task* tasks = (Task*)malloc(sizeof(Task) * bands_count);
+	if (tasks == NULL) {
+		return FALSE;
+	}
+	int i;
+	for (i = 0; i < bands_count; ++i)
+	{
+		int first_row = (long)n * i / bands_count;
+		int last_row = (long)n * (i + 1) / bands_count;
+		if (first_row > 0) {
+			memcpy(simulation->row_buffers[i].above, get_cell_pointer(matrix, first_row - 1, 0), sizeof(int) * n);
+		}
+		if (last_row < n) {
+			memcpy(simulation->row_buffers[i].below, get_cell_pointer(matrix, last_row, 0), sizeof(int) * n);
+		}
+		Task task = {simulation, OPERATION_STEP_IN_PLACE, first_row, 0, last_row - first_row, n, 0, NULL, i, 0, 0};
+		tasks[i] = task;
+	}
+	bool is_executed = execute_round(simulation, pool, tasks, bands_count);
+	free(tasks);
+	return is_executed;
+}
+
+// The leaves are cut into runs along the Z-order curve, where the cost (of the
+// previous generation) adds up to an equal share of the total cost.
+// Runs are contiguous in Z-order, so each one is a few compact blocks of the board
+// (and with LAYOUT_TILES, a contiguous block of memory).
+static bool simulate_step_balanced(Simulation* simulation, WorkerPool* pool)
+{
+	int leaves_per_row = simulation->game_matrix->n / simulation->leaf_size;
+	int leaves_count = leaves_per_row * leaves_per_row;
+	if (!prepare_leaf_costs(simulation, leaves_count)) {
+		return FALSE;
+	}
+	uint64_t total_cost = 0;
+	int i;
+	for (i = 0; i < leaves_count; ++i)
+	{
+		total_cost += simulation->leaf_costs[i];
+	}
+
+	int chunks_count = pool->thread_count * BALANCED_CHUNKS_PER_THREAD;
+	if (chunks_count > leaves_count) {
+		chunks_count = leaves_count;
+	}
+	Task* tasks = (Task*)malloc(sizeof(Task) * chunks_count);
+	if (tasks == NULL) {
+		return FALSE;
+	}
+	int tasks_count = 0;
+	int first_leaf = 0;
+	uint64_t cost = 0;
+	for (i = 0; i < leaves_count; ++i)
+	{
+		cost += simulation->leaf_costs[i];
+		// The last chunk takes whatever is left
+		bool is_chunk_full = tasks_count < chunks_count - 1
+				&& cost * chunks_count >= total_cost * (tasks_count + 1);
+		if (is_chunk_full || i == leaves_count - 1) {
+			Task task = {simulation, OPERATION_STEP_CHUNK, 0, 0, 0, 0, 0, NULL, 0, first_leaf, i + 1 - first_leaf};
+			tasks[tasks_count] = task;
+			tasks_count += 1;
+			first_leaf = i + 1;
+		}
+	}
+	bool is_executed = execute_round(simulation, pool, tasks, tasks_count);
+	free(tasks);
+	return is_executed;
+}
+
+// Allocate the costs of leaves_count leaves, which are all equal until measured.
+// Return FALSE if they can't be allocated.
+static bool prepare_leaf_costs(Simulation* simulation, int leaves_count)
+{
+	if (simulation->leaf_costs_count == leaves_count) {
+		return TRUE;
+	}
+	free(simulation->leaf_costs);
+	simulation->leaf_costs = (uint64_t*)malloc(sizeof(uint64_t) * leaves_count);
+	if (simulation->leaf_costs == NULL) {
+		simulation->leaf_costs_count = 0;
+		return FALSE;
+	}
+	simulation->leaf_costs_count = leaves_count;
+	int i;
+	for (i = 0; i < leaves_count; ++i)
+	{
+		simulation->leaf_costs[i] = 1;
+	}
+	return TRUE;
+}
+
+// Simulate leaves [first_leaf, first_leaf + leaves_count) of the Z-order curve,
+// and record the time each one took as its cost
+static void simulate_step_on_chunk(Simulation* simulation, int first_leaf, int leaves_count, Stats* stats, int* preview)
+{
+	int leaf_size = simulation->leaf_size;
+	uint64_t start = gol_get_time_ns();
+	int i;
+	for (i = first_leaf; i < first_leaf + leaves_count; ++i)
+	{
+		int x = compact_bits(i >> 1) * leaf_size;
+		int y = compact_bits(i) * leaf_size;
+		simulate_step_on_block(simulation, x, y, leaf_size, leaf_size, stats, preview);
+		uint64_t end = gol_get_time_ns();
+		simulation->leaf_costs[i] = end - start;
+		start = end;
+	}
+}
+
+// Allocate buffers for bands_count bands (0 frees the buffers).
+// Return FALSE (with no buffers) if they can't be allocated.
+static bool prepare_row_buffers(Simulation* simulation, int bands_count)
+{
+	if (simulation->row_buffers_count == bands_count) {
+		return TRUE;
+	}
+	int i;
+	for (i = 0; i < simulation->row_buffers_count; ++i)
+	{
+		// Note: all the rows of a band are allocated together, see below
+		free(simulation->row_buffers[i].above);
+	}
+	free(simulation->row_buffers);
+	simulation->row_buffers = NULL;
+	simulation->row_buffers_count = 0;
+	if (bands_count == 0) {
+		return TRUE;
+	}
+
+	int n = simulation->game_matrix->n;
+	// Round rows up to whole cache lines, so bands don't share cache lines
+	size_t row_size = (sizeof(int) * n + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+	simulation->row_buffers = (RowBuffers*)malloc(sizeof(RowBuffers) * bands_count);
+	if (simulation->row_buffers == NULL) {
+		return FALSE;
+	}
+	for (i = 0; i < bands_count; ++i)
+	{
+		char* rows;
+		if (posix_memalign((void**)&rows, CACHE_LINE_SIZE, row_size * 4) != 0) {
+			// Free the bands allocated so far
+			simulation->row_buffers_count = i;
+			prepare_row_buffers(simulation, 0);
+			return FALSE;
+		}
+		simulation->row_buffers[i].above = (int*)rows;
+		simulation->row_buffers[i].below = (int*)(rows + row_size);
+		simulation->row_buffers[i].previous = (int*)(rows + 2 * row_size);
+		simulation->row_buffers[i].current = (int*)(rows + 3 * row_size);
+	}
+	simulation->row_buffers_count = bands_count;
+	return TRUE;
+}
+
+// Simulate rows [x, x + dx) in place.
+// Each row is copied before it's overwritten, so the row below it
+// can still be simulated from the previous generation.
+static void simulate_step_on_band(Simulation* simulation, int band, int x, int dx, Stats* stats, int* preview)
+{
+	Matrix* matrix = simulation->game_matrix;
+	int n = matrix->n;
+	RowBuffers* buffers = &simulation->row_buffers[band];
+	int* previous = buffers->previous;
+	int* current = buffers->current;
+	const int* above = x > 0 ? buffers->above : NULL;
+	int i;
+	for (i = x; i < x + dx; ++i)
+	{
+		int* row = get_cell_pointer(matrix, i, 0);
+		memcpy(current, row, sizeof(int) * n);
+		const int* below;
+		if (i + 1 < x + dx) {
+			below = get_cell_pointer(matrix, i + 1, 0);
+		} else {
+			below = i + 1 < n ? buffers->below : NULL;
+		}
+		simulate_step_on_row(above, current, below, row, i, n, stats);
+		if (preview != NULL) {
+			add_to_preview(simulation, matrix, i, 0, 1, n, preview);
+		}
+
+		// The copy of this row is the row above the next one
+		above = current;
+		int* temp = previous;
+		previous = current;
+		current = temp;
+	}
+}
+
+// Simulate a row (x) into dest, given the previous generation of it
+// and of the rows around it (NULL outside the board).
+// This follows the same rules as simulate_step_on_cell.
+static void simulate_step_on_row(const int* above, const int* row, const int* below, int* dest, int x, int n, Stats* stats)
+{
+	int y;
+	for (y = 0; y < n; ++y)
+	{
+		int first = y > 0 ? y - 1 : y;
+		int last = y < n - 1 ? y + 1 : y;
+		// Note: cells are always 0 or 1, so they can be summed
+		int alive_neighbors = -row[y];
+		int j;
+		for (j = first; j <= last; ++j)
+		{
+			alive_neighbors += row[j];
+			if (above != NULL) alive_neighbors += above[j];
+			if (below != NULL) alive_neighbors += below[j];
+		}
+		bool was_alive = row[y];
+		bool alive = alive_neighbors == 3 || (alive_neighbors == 2 && was_alive);
+		dest[y] = alive;
+		if (stats != NULL) {
+			update_stats(stats, x, y, was_alive, alive);
+		}
+	}
+}
+
+// Return FALSE if the helper matrix can't be allocated
+static bool ensure_helper_matrix(Simulation* simulation)
+{
+	if (!simulation->has_helper_matrix) {
+		Matrix* game_matrix = simulation->game_matrix;
+		simulation->has_helper_matrix = create_matrix(simulation->helper_matrix, game_matrix->n, game_matrix->layout);
+	}
+	return simulation->has_helper_matrix;
+}
+
+// Enqueue tasks on the pool (as the children of the round's root), and wait until they all complete.
+// Return FALSE (without executing them) if the root can't be allocated.
+static bool execute_round(Simulation* simulation, WorkerPool* pool, const Task* tasks, int tasks_count)
+{
+	if (!prepare_task_nodes(simulation, 1)) {
+		return FALSE;
+	}
+	TaskNode* root = &simulation->task_nodes[0];
+	root->pending_children = tasks_count;
+	simulation->is_step_complete = FALSE;
+	// Note: locking is necessary here in order to prevent a race such as this:
+	// http://stackoverflow.com/questions/4544234/calling-pthread-cond-signal-without-locking-mutex
+	// (and since the pool may be shared, other simulations may be enqueuing concurrently)
+	lock_queue(&pool->tasks);
+	int i;
+	for (i = 0; i < tasks_count; ++i)
+	{
+		Task task = tasks[i];
+		task.parent = root;
+		enqueue_task(&pool->tasks, &task);
+	}
+	unlock_queue(&pool->tasks);
+
+	// Wait for task simulation step complete signal
+	uint64_t span_start = gol_begin_span();
+	PCHECK(pthread_mutex_lock(&simulation->step_mutex), "lock mutex failed");
+	while (!simulation->is_step_complete)
+	{
+		PCHECK(pthread_cond_wait(&simulation->step_complete_cond, &simulation->step_mutex), "wait on condition variable failed");
+	}
+	PCHECK(pthread_mutex_unlock(&simulation->step_mutex), "unlock mutex failed");
+	gol_end_span("barrier wait", span_start);
+	return TRUE;
+}
+
+// Allocate (at least) nodes_count task nodes, and link each node to its parent.
+// Note: the nodes' counters are set when their tasks are split (or the round starts),
+// so the nodes are reused as is by the following rounds.
+// Return FALSE if they can't be allocated.
+static bool prepare_task_nodes(Simulation* simulation, int nodes_count)
+{
+	if (simulation->task_nodes_count >= nodes_count) {
+		return TRUE;
+	}
+	free(simulation->task_nodes);
+	simulation->task_nodes = NULL;
+	simulation->task_nodes_count = 0;
+	TaskNode* nodes;
+	// Note: malloc doesn't guarantee cache line alignment
+	if (posix_memalign((void**)&nodes, CACHE_LINE_SIZE, sizeof(TaskNode) * nodes_count) != 0) {
+		return FALSE;
+	}
+	simulation->task_nodes = nodes;
+	simulation->task_nodes_count = nodes_count;
+	nodes[0].parent = NULL;
+	int i;
+	for (i = 1; i < nodes_count; ++i)
+	{
+		// Quadrant q = i - 1 is the child of quadrant (q - 1) / 4, and the board is the child of the root
+		nodes[i].parent = i == 1 ? &nodes[0] : &nodes[1 + (i - 2) / 4];
+	}
+	return TRUE;
+}
+
+// Complete one child of a node. The last child to complete completes the node
+// (and so on up the tree), so each counter is only shared by a node's children,
+// and only the completion of the round's root wakes the waiting thread.
+static void complete_child(Simulation* simulation, TaskNode* node)
+{
+	while (__sync_sub_and_fetch(&node->pending_children, 1) == 0)
+	{
+		if (node->parent != NULL) {
+			node = node->parent;
+			continue;
+		}
+		// Note: locking is necessary here in order to prevent a race such as this:
+		// http://stackoverflow.com/questions/4544234/calling-pthread-cond-signal-without-locking-mutex
+		PCHECK(pthread_mutex_lock(&simulation->step_mutex), "lock mutex failed");
+		simulation->is_step_complete = TRUE;
+		PCHECK(pthread_cond_signal(&simulation->step_complete_cond), "condition signal failed");
+		PCHECK(pthread_mutex_unlock(&simulation->step_mutex), "unlock mutex failed");
+		return;
+	}
+}
+
+static void fill_random_rows(Simulation* simulation, int x, int dx)
+{
+	Matrix* matrix = simulation->game_matrix;
+	int i, y;
+	for (i = x; i < x + dx; ++i)
+	{
+		for (y = 0; y < matrix->n; ++y)
+		{
+			uint64_t hash = hash_cell(simulation->random_seed, (uint64_t)i * matrix->n + y);
+			*get_cell_pointer(matrix, i, y) = (hash >> 11) < simulation->random_threshold ? 1 : 0;
+		}
+	}
+}
+
+// Note: this is the splitmix64 finalizer, applied to the seed mixed with the cell index.
+// see: http://xoroshiro.di.unimi.it/splitmix64.c
+static uint64_t hash_cell(uint64_t seed, uint64_t index)
+{
+	uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Note: the block's preview counts are added right after it's simulated, while it's in the cache
+static void simulate_step_on_block(Simulation* simulation, int x, int y, int dx, int dy, Stats* stats, int* preview)
+{
+	Matrix* source = simulation->game_matrix;
+	Matrix* dest = simulation->helper_matrix;
+	if (source->layout == LAYOUT_TILES && dx == 1 << source->tile_shift) {
+		simulate_step_on_tile(source, dest, x, y, stats);
+	} else {
+		int i, j;
+		for (i = x; i < x + dx; ++i)
+		{
+			for (j = y; j < y + dy; ++j)
+			{
+				bool was_alive = is_alive(source, i, j);
+				bool alive = simulate_step_on_cell(source, dest, i, j);
+				if (stats != NULL) {
+					update_stats(stats, i, j, was_alive, alive);
+				}
+			}
+		}
+	}
+	if (preview != NULL) {
+		add_to_preview(simulation, dest, x, y, dx, dy, preview);
+	}
+}
+
+// Simulate a single tile of LAYOUT_TILES matrices (x and y are the tile's first cell).
+// The neighbors of cells inside the tile are in the tile itself,
+// so they are counted directly (only the tile's border goes through simulate_step_on_cell).
+static void simulate_step_on_tile(Matrix* source, Matrix* dest, int x, int y, Stats* stats)
+{
+	int tile_size = 1 << source->tile_shift;
+	const int* source_tile = get_cell_pointer(source, x, y);
+	int* dest_tile = get_cell_pointer(dest, x, y);
+	int i, j;
+	for (i = 0; i < tile_size; ++i)
+	{
+		for (j = 0; j < tile_size; ++j)
+		{
+			bool was_alive, alive;
+			if (i == 0 || j == 0 || i == tile_size - 1 || j == tile_size - 1) {
+				was_alive = is_alive(source, x + i, y + j);
+				alive = simulate_step_on_cell(source, dest, x + i, y + j);
+			} else {
+				// Note: cells are always 0 or 1, so they can be summed
+				const int* cell = &source_tile[(i << source->tile_shift) + j];
+				int alive_neighbors =
+						cell[-tile_size - 1] + cell[-tile_size] + cell[-tile_size + 1] +
+						cell[-1]                                + cell[1] +
+						cell[tile_size - 1]  + cell[tile_size]  + cell[tile_size + 1];
+				was_alive = *cell;
+				alive = alive_neighbors == 3 || (alive_neighbors == 2 && was_alive);
+				dest_tile[(i << source->tile_shift) + j] = alive;
+			}
+			if (stats != NULL) {
+				update_stats(stats, x + i, y + j, was_alive, alive);
+			}
+		}
+	}
+}
+
+// Returns whether the cell is alive in the next generation
+static bool simulate_step_on_cell(Matrix* source, Matrix* dest, int x, int y)
+{
+	int alive_neighbors = count_alive_neighbors(source, x, y);
+	if (is_alive(source, x, y)) {
+		if (alive_neighbors < 2 || alive_neighbors > 3) {
+			// Kill cell
+			*get_cell_pointer(dest, x, y) = 0;
+		} else {
+			// Keep alive
+			*get_cell_pointer(dest, x, y) = 1;
+		}
+	} else /* Cell is dead */ {
+		if (alive_neighbors == 3) {
+			// Revive cell
+			*get_cell_pointer(dest, x, y) = 1;
+		} else {
+			// Keep dead
+			*get_cell_pointer(dest, x, y) = 0;
+		}
+	}
+	return *get_cell_pointer(dest, x, y);
+}
+
+static void reset_stats(Stats* stats)
+{
+	stats->population = 0;
+	stats->births = 0;
+	stats->deaths = 0;
+	stats->min_x = -1;
+	stats->min_y = -1;
+	stats->max_x = -1;
+	stats->max_y = -1;
+	stats->imbalance = 1;
+}
+
+static void update_stats(Stats* stats, int x, int y, bool was_alive, bool alive)
+{
+	if (alive) {
+		stats->population += 1;
+		if (stats->min_x == -1 || x < stats->min_x) stats->min_x = x;
+		if (stats->min_y == -1 || y < stats->min_y) stats->min_y = y;
+		if (x > stats->max_x) stats->max_x = x;
+		if (y > stats->max_y) stats->max_y = y;
+		if (!was_alive) {
+			stats->births += 1;
+		}
+	} else if (was_alive) {
+		stats->deaths += 1;
+	}
+}
+
+static void merge_stats(Stats* stats, const Stats* other)
+{
+	stats->population += other->population;
+	stats->births += other->births;
+	stats->deaths += other->deaths;
+	if (other->population == 0) {
+		return;
+	}
+	if (stats->min_x == -1 || other->min_x < stats->min_x) stats->min_x = other->min_x;
+	if (stats->min_y == -1 || other->min_y < stats->min_y) stats->min_y = other->min_y;
+	if (other->max_x > stats->max_x) stats->max_x = other->max_x;
+	if (other->max_y > stats->max_y) stats->max_y = other->max_y;
+}
+
+void gol_write_stats_header(FILE* file)
+{
+	fprintf(file, "# generation population births deaths min_x min_y max_x max_y imbalance\n");
+}
+
+void gol_write_stats(FILE* file, int generation, const Stats* stats)
+{
+	fprintf(file, "%d %ld %ld %ld %d %d %d %d %.2f\n",
+			generation, stats->population, stats->births, stats->deaths,
+			stats->min_x, stats->min_y, stats->max_x, stats->max_y, stats->imbalance);
+}
+
+static int count_alive_neighbors(const Matrix* matrix, int x, int y)
+{
+	int alive_neighbors = 0;
+	int i, j;
+	for (i = x - 1; i <= x + 1; ++i)
+	{
+		for (j = y - 1; j <= y + 1; ++j)
+		{
+			if (i < 0 || i >= matrix->n
+					|| j < 0 || j >= matrix->n
+					|| (i == x && j == y)) {
+				continue;
+			}
+			if (is_alive(matrix, i, j)) {
+				alive_neighbors += 1;
+			}
+		}
+	}
+	return alive_neighbors;
+}
+
+static bool is_alive(const Matrix* matrix, int x, int y)
+{
+	return *get_cell_pointer(matrix, x, y) == 1;
+}
+
+char* gol_read_board_file(const char* file_path, int* n)
+{
+	int fd = open_board_file(file_path, n);
+	if (fd == -1) {
+		return NULL;
+	}
+	size_t size = (size_t)*n * *n;
+	char* buffer = (char*)malloc(size);
+	size_t total_read = 0;
+	while (buffer != NULL && total_read < size)
+	{
+		ssize_t bytes_read = read(fd, buffer + total_read, size - total_read);
+		// Note: the end of the file is an error too, since the file may have been truncated.
+		if (bytes_read <= 0) {
+			free(buffer);
+			buffer = NULL;
+			break;
+		}
+		total_read += bytes_read;
+	}
+	close(fd);
+	return buffer;
+}
+
+// Open a board file, in the format of gol_create_simulation_from_buffer, and get its dimension.
+// Return -1 if the file can't be opened, or its length isn't a square.
+static int open_board_file(const char* file_path, int* n)
+{
+	int fd = open(file_path, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	struct stat file_stat;
+	*n = 0;
+	if (fstat(fd, &file_stat) == 0 && 0 < file_stat.st_size && file_stat.st_size <= UINT_MAX) {
+		*n = sqrt_(file_stat.st_size);
+	}
+	if (*n == 0 || (off_t)*n * *n != file_stat.st_size) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Load a board file (see open_board_file).
+// Return FALSE if it can't be read, or the matrix can't be allocated.
+static bool load_matrix(Matrix* matrix, const char* file_path)
+{
+	int n;
+	int fd = open_board_file(file_path, &n);
+	if (fd == -1) {
+		return FALSE;
+	}
+	if (!create_matrix(matrix, n, LAYOUT_ROWS)) {
+		close(fd);
+		return FALSE;
+	}
+
+	char* buffer = (char*)malloc(MEGA);
+	bool is_loaded = buffer != NULL;
+	int x, y;
+	int i = 0;
+	int bytes_read = 0;
+	for (x = 0; x < n && is_loaded; ++x)
+	{
+		for (y = 0; y < n; ++y)
+		{
+			if (i == bytes_read) {
+				bytes_read = read(fd, buffer, MEGA);
+				// Note: the end of the file is an error too, since the file may have been truncated.
+				if (bytes_read <= 0) {
+					is_loaded = FALSE;
+					break;
+				}
+				i = 0;
+			}
+			*get_cell_pointer(matrix, x, y) = buffer[i] == '\0' ? 0 : 1;
+			i += 1;
+		}
+	}
+
+	free(buffer);
+	close(fd);
+	if (!is_loaded) {
+		destroy_matrix(matrix);
+	}
+	return is_loaded;
+}
+
+// Return FALSE (with nothing allocated) if the cells can't be allocated
+static bool create_matrix(Matrix* matrix, int n, Layout layout)
+{
+	matrix->n = n;
+	matrix->layout = layout;
+	matrix->cols = NULL;
+	matrix->tiles = NULL;
+	matrix->tile_shift = 0;
+	if (layout == LAYOUT_TILES) {
+		assert(is_power_of_2(n));
+		while ((1 << matrix->tile_shift) < TILE_SIZE && (1 << matrix->tile_shift) < n)
+		{
+			matrix->tile_shift += 1;
+		}
+		// Note: malloc doesn't guarantee cache line alignment
+		return posix_memalign((void**)&matrix->tiles, CACHE_LINE_SIZE, sizeof(int) * n * n) == 0;
+	}
+	matrix->cols = (int**)malloc(sizeof(int*) * n);
+	if (matrix->cols == NULL) {
+		return FALSE;
+	}
+	int i;
+	for (i = 0; i < n; ++i)
+	{
+		matrix->cols[i] = (int*)malloc(sizeof(int) * n);
+		if (matrix->cols[i] == NULL) {
+			matrix->n = i;
+			destroy_matrix(matrix);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// Kill all the cells
+static void clear_matrix(Matrix* matrix)
+{
+	if (matrix->layout == LAYOUT_TILES) {
+		memset(matrix->tiles, 0, sizeof(int) * matrix->n * matrix->n);
+		return;
+	}
+	int i;
+	for (i = 0; i < matrix->n; ++i)
+	{
+		memset(matrix->cols[i], 0, sizeof(int) * matrix->n);
+	}
+}
+
+// Copy the cells of a matrix of the same size (and any layout)
+static void copy_matrix(Matrix* dest, const Matrix* source)
+{
+	assert(dest->n == source->n);
+	int x, y;
+	for (x = 0; x < source->n; ++x)
+	{
+		for (y = 0; y < source->n; ++y)
+		{
+			*get_cell_pointer(dest, x, y) = *get_cell_pointer(source, x, y);
+		}
+	}
+}
+
+static void destroy_matrix(Matrix* matrix)
+{
+	if (matrix->layout == LAYOUT_TILES) {
+		free(matrix->tiles);
+		return;
+	}
+	int i;
+	for (i = 0; i < matrix->n; ++i)
+	{
+		free(matrix->cols[i]);
+	}
+	free(matrix->cols);
+}
+
+static inline int* get_cell_pointer(const Matrix* matrix, int x, int y)
+{
+	if (matrix->layout == LAYOUT_ROWS) {
+		return &matrix->cols[x][y];
+	}
+	int shift = matrix->tile_shift;
+	int mask = (1 << shift) - 1;
+	size_t tile_index = get_morton_index(x >> shift, y >> shift);
+	return &matrix->tiles[(tile_index << (2 * shift)) + ((x & mask) << shift) + (y & mask)];
+}
+
+// Interleave the bits of x and y (x's bits are the odd ones).
+// In this order, every aligned power of 2 quadrant of tiles is contiguous.
+static inline size_t get_morton_index(unsigned int x, unsigned int y)
+{
+	return (spread_bits(x) << 1) | spread_bits(y);
+}
+
+// Spread the low 32 bits, so there is a 0 bit between each pair of bits.
+// Note: see: graphics.stanford.edu/~seander/bithacks.html#InterleaveBMN
+static inline uint64_t spread_bits(uint64_t bits)
+{
+	bits &= 0xFFFFFFFFULL;
+	bits = (bits | (bits << 16)) & 0x0000FFFF0000FFFFULL;
+	bits = (bits | (bits << 8)) & 0x00FF00FF00FF00FFULL;
+	bits = (bits | (bits << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	bits = (bits | (bits << 2)) & 0x3333333333333333ULL;
+	bits = (bits | (bits << 1)) & 0x5555555555555555ULL;
+	return bits;
+}
+
+// The inverse of spread_bits: gather the even bits into the low 32 bits
+static inline unsigned int compact_bits(uint64_t bits)
+{
+	bits &= 0x5555555555555555ULL;
+	bits = (bits | (bits >> 1)) & 0x3333333333333333ULL;
+	bits = (bits | (bits >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+	bits = (bits | (bits >> 4)) & 0x00FF00FF00FF00FFULL;
+	bits = (bits | (bits >> 8)) & 0x0000FFFF0000FFFFULL;
+	bits = (bits | (bits >> 16)) & 0x00000000FFFFFFFFULL;
+	return bits;
+}
+
+static int is_power_of_2 (unsigned int x)
+{
+	// Note: taken from www.exploringbinary.com/ten-ways-to-check-if-an-integer-is-a-power-of-two-in-c
+	return ((x != 0) && ((x & (~x + 1)) == x));
+}
+
+// Note: taken from http:unsigned int/stackoverflow.com/a/1101217
+// This is used instead of the standard sqrt(),
+// because the standard math sqrt requires linking with libmath.
+static unsigned int sqrt_(unsigned int n)
+{
+	unsigned int op  = n;
+	unsigned int res = 0;
+	unsigned int one = 1uL << 30; // The second-to-top bit is set: use 1u << 14 for uint16_t type; use 1uL<<30 for uint32_t type
+
+
+    // "one" starts at the highest power of four <= than the argument.
+    while (one > op)
+    {
+        one >>= 2;
+    }
+
+    while (one != 0)
+    {
+        if (op >= res + one)
+        {
+            op = op - (res + one);
+            res = res +  2 * one;
+        }
+        res >>= 1;
+        one >>= 2;
+    }
+    return res;
+}
+
+static void init_queue(TaskQueue* queue, int capacity)
+{
+	queue->first_task_index = 0;
+	queue->task_count = 0;
+	queue->blocks_count = (capacity + TASKS_PER_BLOCK - 1) / TASKS_PER_BLOCK;
+	queue->capacity = TASKS_PER_BLOCK * queue->blocks_count;
+	queue->task_blocks = (Task**)malloc(sizeof(*queue->task_blocks) * queue->blocks_count);
+	VERIFY(queue->task_blocks != NULL, "malloc task block pointers failed");
+	int i;
+	for (i = 0; i < queue->blocks_count; ++i) {
+		queue->task_blocks[i] = (Task*)malloc(sizeof(Task) * TASKS_PER_BLOCK);
+		VERIFY(queue->task_blocks[i] != NULL, "malloc task block failed");
+	}
+	PCHECK(pthread_mutex_init(&queue->mutex, NULL), "init mutex failed");
+	PCHECK(pthread_cond_init(&queue->not_empty_cond, NULL), "init condition variable failed");
+}
+
+static void uninit_queue(TaskQueue* queue)
+{
+	int i;
+	for (i = 0; i < queue->blocks_count; ++i) {
+		free(queue->task_blocks[i]);
+	}
+	free(queue->task_blocks);
+	PCHECK(pthread_cond_destroy(&queue->not_empty_cond), "destroy condition variable failed");
+	PCHECK(pthread_mutex_destroy(&queue->mutex), "destroy mutex failed");
+}
+
+// Double the capacity of a full queue.
+// Since the pool may be shared by any number of simulations,
+// the queue can't be allocated up front for the largest possible step.
+// Note: the queue must be locked.
+static void grow_queue(TaskQueue* queue)
+{
+	assert(queue->task_count == queue->capacity);
+	int blocks_count = queue->blocks_count * 2;
+	Task** task_blocks = (Task**)malloc(sizeof(*task_blocks) * blocks_count);
+	VERIFY(task_blocks != NULL, "malloc task block pointers failed");
+	int i;
+	for (i = 0; i < blocks_count; ++i) {
+		task_blocks[i] = (Task*)malloc(sizeof(Task) * TASKS_PER_BLOCK);
+		VERIFY(task_blocks[i] != NULL, "malloc task block failed");
+	}
+	// Copy the tasks in order, so the new queue starts at index 0
+	for (i = 0; i < queue->task_count; ++i) {
+		div_t q = div(i, TASKS_PER_BLOCK);
+		task_blocks[q.quot][q.rem] = *get_task(queue, i);
+	}
+	for (i = 0; i < queue->blocks_count; ++i) {
+		free(queue->task_blocks[i]);
+	}
+	free(queue->task_blocks);
+
+	queue->task_blocks = task_blocks;
+	queue->blocks_count = blocks_count;
+	queue->capacity = TASKS_PER_BLOCK * blocks_count;
+	queue->first_task_index = 0;
+}
+
+static void lock_queue(TaskQueue* queue)
+{
+	PCHECK(pthread_mutex_lock(&queue->mutex), "lock mutex failed");
+}
+
+static void unlock_queue(TaskQueue* queue)
+{
+	PCHECK(pthread_mutex_unlock(&queue->mutex), "unlock mutex failed");
+}
+
+static bool is_queue_empty(const TaskQueue* queue)
+{
+	return queue->task_count == 0;
+}
+
+static Task* get_task(const TaskQueue* queue, int index)
+{
+	int task_index = (queue->first_task_index + index) % queue->capacity;
+	div_t q = div(task_index, TASKS_PER_BLOCK);
+	return &queue->task_blocks[q.quot][q.rem];
+}
+
+static Task* first_task(const TaskQueue* queue)
+{
+	return get_task(queue, 0);
+}
+
+// Note: the queue must be locked.
+static void enqueue_task(TaskQueue* queue, const Task* task)
+{
+	if (queue->task_count == queue->capacity) {
+		grow_queue(queue);
+	}
+	Task* new_task = get_task(queue, queue->task_count);
+	*new_task = *task;
+
+	queue->task_count += 1;
+	if (queue->task_count == 1) {
+		PCHECK(pthread_cond_signal(&queue->not_empty_cond), "condition signal failed");
+	}
+}
+
+// Note: the queue must be locked.
+static void dequeue_task(TaskQueue* queue, Task* task)
+{
+	if (is_queue_empty(queue)) {
+		fprintf(stderr, "Error, tried to dequeue from empty queue\n");
+		exit(EXIT_FAILURE);
+	}
+
+	*task = *first_task(queue);
+	queue->first_task_index = (queue->first_task_index + 1) % queue->capacity;
+	queue->task_count -= 1;
+}
+
+static void* execute_tasks(void* arg)
+{
+	Worker* worker = (Worker*)arg;
+	WorkerPool* pool = worker->pool;
+	TaskQueue* queue = &pool->tasks;
+	char thread_name[32];
+	snprintf(thread_name, sizeof(thread_name), "worker %d", worker->index);
+	gol_set_trace_thread_name(thread_name);
+	while (TRUE)
+	{
+		lock_queue(queue);
+		if (is_queue_empty(queue) && pool->should_worker_continue) {
+			uint64_t span_start = gol_begin_span();
+			while (is_queue_empty(queue) && pool->should_worker_continue)
+			{
+				PCHECK(pthread_cond_wait(&queue->not_empty_cond, &queue->mutex), "wait on condition variable failed");
+			}
+			gol_end_span("idle", span_start);
+		}
+		if (!pool->should_worker_continue) {
+			unlock_queue(queue);
+			return NULL;
+		}
+		Task task;
+		dequeue_task(queue, &task);
+		// Note: there may be more tasks left, and since enqueue_task only
+		// signals when the queue becomes non empty, wake another worker for them.
+		if (!is_queue_empty(queue)) {
+			PCHECK(pthread_cond_signal(&queue->not_empty_cond), "condition signal failed");
+		}
+		unlock_queue(queue);
+
+		Simulation* simulation = task.simulation;
+		WorkerStats* worker_stats = simulation->should_gather_stats ? &simulation->thread_stats[worker->index] : NULL;
+		uint64_t task_start = worker_stats != NULL ? gol_get_time_ns() : 0;
+		int* preview = simulation->preview_counts != NULL
+				? &simulation->thread_previews[worker->index * simulation->preview_stride] : NULL;
+		uint64_t span_start = gol_begin_span();
+		bool completed_leaf = execute_task(queue, &task, worker_stats != NULL ? &worker_stats->stats : NULL, preview);
+		gol_end_span(completed_leaf ? OPERATION_NAMES[task.operation] : "split", span_start);
+		if (completed_leaf) {
+			// Note: only leaves are timed, since the round may be over (and its
+			// statistics gathered) as soon as its last leaf is completed.
+			if (worker_stats != NULL) {
+				worker_stats->busy_time += gol_get_time_ns() - task_start;
+			}
+			complete_child(simulation, task.parent);
+		}
+	}
+
+	return NULL;
+}
+
+// Returns whether the task was a leaf (which wasn't split into other tasks).
+// A split task completes when its children do (see complete_child).
+// Note: stats is the executing worker's partial statistics (NULL if not gathering statistics),
+// and preview is its partial preview counts (NULL if no preview was requested)
+static bool execute_task(TaskQueue* queue, const Task* task, Stats* stats, int* preview)
+{
+	Simulation* simulation = task->simulation;
+	if (task->operation == OPERATION_FILL_RANDOM) {
+		fill_random_rows(simulation, task->x, task->dx);
+		return TRUE;
+	}
+	if (task->operation == OPERATION_STEP_IN_PLACE) {
+		simulate_step_on_band(simulation, task->band, task->x, task->dx, stats, preview);
+		return TRUE;
+	}
+	if (task->operation == OPERATION_STEP_CHUNK) {
+		simulate_step_on_chunk(simulation, task->first_leaf, task->leaves_count, stats, preview);
+		return TRUE;
+	}
+	if (task->dx == simulation->leaf_size && task->dy == simulation->leaf_size) {
+		simulate_step_on_block(simulation, task->x, task->y, task->dx, task->dy, stats, preview);
+		return TRUE;
+	} else {
+		int half_dx = task->dx / 2;
+		int half_dy = task->dy / 2;
+		assert(half_dx * 2 == task->dx);
+		assert(half_dy * 2 == task->dy);
+		TaskNode* node = &simulation->task_nodes[1 + task->node];
+		assert(node->parent == task->parent);
+		// Note: no child was enqueued yet, so no other worker is using the node
+		node->pending_children = 4;
+		int child = 4 * task->node + 1;
+		Task task1 = {simulation, OPERATION_STEP, task->x          , task->y          , half_dx, half_dy, child    , node, 0, 0, 0};
+		Task task2 = {simulation, OPERATION_STEP, task->x + half_dx, task->y          , half_dx, half_dy, child + 1, node, 0, 0, 0};
+		Task task3 = {simulation, OPERATION_STEP, task->x          , task->y + half_dy, half_dx, half_dy, child + 2, node, 0, 0, 0};
+		Task task4 = {simulation, OPERATION_STEP, task->x + half_dx, task->y + half_dy, half_dx, half_dy, child + 3, node, 0, 0, 0};
+		lock_queue(queue);
+		enqueue_task(queue, &task1);
+		enqueue_task(queue, &task2);
+		enqueue_task(queue, &task3);
+		enqueue_task(queue, &task4);
+		unlock_queue(queue);
+		return FALSE;
+	}
+}
@@ -0,0 +1,145 @@
+#ifndef GOL_ENGINE_H_
+#define GOL_ENGINE_H_
+
+#include <stdio.h>
+#include "gol_trace.h"
+#include "gol_preview.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Game of life engine.
+//
+// All the state of a simulation is held by its Simulation handle,
+// so a process may run any number of simulations.
+// Simulations are stepped either serially (pool == NULL),
+// or by the threads of a WorkerPool. A single pool may be shared by
+// many simulations, which may be stepped concurrently from different threads.
+// Note: a single simulation must not be stepped concurrently.
+// Note: only boards whose dimension is a power of 2 can be stepped by a pool
+// (see gol_can_step_in_pool), serial steps support any dimension.
+//
+
+//
+// Structs
+//
+
+typedef struct Simulation_t Simulation;
+typedef struct WorkerPool_t WorkerPool;
+
+// How the cells of a simulation are stored in memory
+typedef enum Layout_t
+{
+	// Row after row (the default)
+	LAYOUT_ROWS,
+	// Square tiles, laid out in Z-order (Morton order), so every quadrant of the
+	// step's recursive split is one contiguous block, and tiles are cache line aligned.
+	// The board dimension must be a power of 2.
+	LAYOUT_TILES,
+} Layout;
+
+// Statistics of a single generation, accumulated while stepping.
+// The bounding box is (-1, -1, -1, -1) when no cell is alive.
+// imbalance is the ratio of the busiest worker's time to the mean time of
+// the pool's workers (1 is perfectly balanced, and so is a serial step).
+// Partial Stats are accumulated by each worker, so they are padded
+// to a cache line (64 bytes) in order to avoid false sharing between workers.
+typedef struct Stats_t
+{
+	long population;
+	long births;
+	long deaths;
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+	double imbalance;
+} __attribute__((aligned(64))) Stats;
+
+//
+// Function Declarations
+//
+
+WorkerPool* gol_create_worker_pool(int thread_count);
+void gol_destroy_worker_pool(WorkerPool* pool);
+int gol_get_thread_count(const WorkerPool* pool);
+
+// The simulation constructors return NULL if their input is invalid (e.g. n < 1, or a
+// missing or malformed file) or the board can't be allocated, instead of exiting,
+// so a process that embeds the engine can report the error and carry on.
+
+// Create a simulation of an n*n board with all cells dead
+Simulation* gol_create_simulation(int n);
+// Create a simulation from n*n bytes, one per cell (row after row), non zero is alive
+Simulation* gol_create_simulation_from_buffer(const char* buffer, int n);
+// Create a simulation from a file in the format of gol_create_simulation_from_buffer
+// (its length must be a square)
+Simulation* gol_create_simulation_from_file(const char* file_path);
+// Create a simulation of an n*n board where each cell is alive with probability density.
+// The board is determined by the seed alone (it doesn't depend on the pool's thread count).
+// The board is filled by the pool, or serially if pool is NULL.
+Simulation* gol_create_random_simulation(int n, double density, unsigned long seed, WorkerPool* pool);
+void gol_destroy_simulation(Simulation* simulation);
+
+// The setters and the steps below return 0 (leaving the simulation as it was) if their
+// arguments are invalid or a buffer can't be allocated, and nonzero on success.
+
+// Convert the simulation's cells to another layout.
+// LAYOUT_TILES isn't supported in place.
+int gol_set_layout(Simulation* simulation, Layout layout);
+Layout gol_get_layout(const Simulation* simulation);
+// Update the cells in place, keeping only a few rows of the previous generation
+// per band of rows (instead of a second matrix), which halves the simulation's memory.
+// Only supported by LAYOUT_ROWS.
+int gol_set_in_place(Simulation* simulation, int is_in_place);
+// Split the steps of a pool into runs of tiles along the Z-order curve, of about
+// equal cost (as measured in the previous generation), instead of equal quadrants,
+// so workers finish together even when the activity is concentrated in a few regions.
+// The board dimension must be a power of 2. Not used by serial and in place steps.
+int gol_set_balanced(Simulation* simulation, int is_balanced);
+// Return whether an n*n board can be stepped by a pool (n must be a power of 2)
+int gol_can_step_in_pool(int n);
+int gol_get_size(const Simulation* simulation);
+int gol_get_generation(const Simulation* simulation);
+int gol_get_cell(const Simulation* simulation, int x, int y);
+void gol_set_cell(Simulation* simulation, int x, int y, int alive);
+// Replace all the cells by n*n bytes in the format of gol_create_simulation_from_buffer,
+// and restart the generation count (this reuses the simulation's memory)
+void gol_import_cells(Simulation* simulation, const char* buffer);
+// Export the cells into n*n bytes, in the format of gol_create_simulation_from_buffer
+void gol_export_cells(const Simulation* simulation, char* buffer);
+// Save the cells to a file in the format of gol_create_simulation_from_file.
+// Return 0 if the file can't be written.
+int gol_save_simulation(const Simulation* simulation, const char* file_path);
+// Read a file in the format of gol_create_simulation_from_file into a new n*n buffer
+// (which the caller frees). Return NULL if the file can't be read or its length isn't a square.
+char* gol_read_board_file(const char* file_path, int* n);
+void gol_print_simulation(const Simulation* simulation);
+
+// Count the alive cells of the next generation in width*height blocks of the board
+// (a block per pixel of a downsampled image), into counts (width*height ints, row after row).
+// The cells are counted by the next step, while it simulates them.
+// Return 0 if the preview isn't supported (see gol_can_preview), or can't be allocated.
+int gol_request_preview(Simulation* simulation, int* counts, int width, int height);
+
+// Simulate one generation.
+// If stats isn't NULL, the generation's statistics are gathered into it
+// during the same pass over the board.
+// If pool isn't NULL, the board dimension must be a power of 2.
+int gol_simulate_step(Simulation* simulation, WorkerPool* pool, Stats* stats);
+// Simulate steps generations, and return the time it took in milliseconds
+// (or -1 if a step failed, see gol_simulate_step).
+// If stats_file isn't NULL, a line of statistics is written to it per generation.
+// If latencies isn't NULL, the time of each generation (in nanoseconds) is recorded in it.
+// If previews isn't NULL, a preview is submitted to it every interval generations.
+long gol_simulate(Simulation* simulation, WorkerPool* pool, int steps, FILE* stats_file, Histogram* latencies, PreviewWriter* previews);
+void gol_write_stats_header(FILE* file);
+void gol_write_stats(FILE* file, int generation, const Stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOL_ENGINE_H_ */
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <error.h>
+#include "common.h"
+#include "gol_pattern.h"
+
+//
+// Function Declarations
+//
+
+static bool load_cells(Simulation* simulation, FILE* file, int offset_x, int offset_y);
+static bool load_rle(Simulation* simulation, FILE* file, int offset_x, int offset_y);
+static void skip_line(FILE* file);
+static void set_alive_cells(Simulation* simulation, int line, int column, int count);
+static bool has_extension(const char* file_path, const char* extension);
+
+//
+// Implementation
+//
+
+bool gol_is_pattern_file(const char* file_path)
+{
+	return has_extension(file_path, ".cells") || has_extension(file_path, ".rle");
+}
+
+Simulation* gol_create_simulation_from_pattern(const char* file_path, int n, int offset_x, int offset_y)
+{
+	assert(offset_x >= 0 && offset_y >= 0);
+	// Note: a pattern past the board is dropped anyway, so the offsets are clamped
+	// to n (which keeps the positions from overflowing).
+	offset_x = offset_x < n ? offset_x : n;
+	offset_y = offset_y < n ? offset_y : n;
+	FILE* file = fopen(file_path, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	uint64_t span_start = gol_begin_span();
+	Simulation* simulation = gol_create_simulation(n);
+	if (simulation != NULL) {
+		bool is_loaded;
+		if (has_extension(file_path, ".rle")) {
+			is_loaded = load_rle(simulation, file, offset_x, offset_y);
+		} else {
+			is_loaded = load_cells(simulation, file, offset_x, offset_y);
+		}
+		if (!is_loaded || ferror(file)) {
+			gol_destroy_simulation(simulation);
+			simulation = NULL;
+		}
+	}
+
+	fclose(file);
+	gol_end_span("load pattern", span_start);
+	return simulation;
+}
+
+// Lines starting with '!' are comments, 'O' is an alive cell and '.' is a dead cell.
+// Return FALSE on any other char.
+static bool load_cells(Simulation* simulation, FILE* file, int offset_x, int offset_y)
+{
+	int line = offset_y;
+	int column = offset_x;
+	bool is_line_start = TRUE;
+	int c;
+	while ((c = getc(file)) != EOF)
+	{
+		if (c == '\n') {
+			line += 1;
+			column = offset_x;
+			is_line_start = TRUE;
+			continue;
+		}
+		if (c == '\r') {
+			continue;
+		}
+		if (is_line_start && c == '!') {
+			skip_line(file);
+			continue;
+		}
+		is_line_start = FALSE;
+		if (c == 'O') {
+			set_alive_cells(simulation, line, column, 1);
+		} else if (c != '.') {
+			return FALSE;
+		}
+		column += 1;
+	}
+	return TRUE;
+}
+
+// After '#' comment lines and a "x = <width>, y = <height>, ..." header line,
+// the cells are given as runs of "<count><tag>" (the count defaults to 1),
+// where the tag is 'b' for dead cells, 'o' (or any other letter) for alive cells,
+// and '$' for the end of a line. The pattern ends with '!'.
+// Return FALSE on any other char.
+static bool load_rle(Simulation* simulation, FILE* file, int offset_x, int offset_y)
+{
+	int c;
+	while ((c = getc(file)) != EOF)
+	{
+		if (c == '#' || c == 'x') {
+			skip_line(file);
+		} else if (!isspace(c)) {
+			ungetc(c, file);
+			break;
+		}
+	}
+
+	int n = gol_get_size(simulation);
+	int line = offset_y;
+	int column = offset_x;
+	int count = 0;
+	while ((c = getc(file)) != EOF && c != '!')
+	{
+		if (isdigit(c)) {
+			// Note: a run longer than the board ends outside of it anyway, so the count is
+			// capped at n (and so are the positions below), which keeps them from overflowing.
+			count = count * 10 + (c - '0');
+			count = count < n ? count : n;
+			continue;
+		}
+		if (isspace(c)) {
+			continue;
+		}
+		int run = count == 0 ? 1 : count;
+		count = 0;
+		if (c == '$') {
+			line = line + run < n ? line + run : n;
+			column = offset_x;
+		} else if (c == 'b') {
+			column = column + run < n ? column + run : n;
+		} else if (isalpha(c)) {
+			set_alive_cells(simulation, line, column, run);
+			column = column + run < n ? column + run : n;
+		} else {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void skip_line(FILE* file)
+{
+	int c;
+	do {
+		c = getc(file);
+	} while (c != '\n' && c != EOF);
+}
+
+// Set count cells of a line alive, dropping those outside the board
+static void set_alive_cells(Simulation* simulation, int line, int column, int count)
+{
+	int n = gol_get_size(simulation);
+	if (line < 0 || line >= n || column < 0 || column >= n || count < 0) {
+		return;
+	}
+	int end_column = count < n - column ? column + count : n;
+	int y;
+	for (y = column; y < end_column; ++y)
+	{
+		gol_set_cell(simulation, line, y, TRUE);
+	}
+}
+
+static bool has_extension(const char* file_path, const char* extension)
+{
+	size_t path_length = strlen(file_path);
+	size_t extension_length = strlen(extension);
+	return path_length >= extension_length
+			&& strcmp(file_path + path_length - extension_length, extension) == 0;
+}
@@ -0,0 +1,36 @@
+#ifndef GOL_PATTERN_H_
+#define GOL_PATTERN_H_
+
+#include "gol_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Pattern files importer.
+//
+// Supported formats (chosen by the file extension):
+//   .cells - plaintext, see: www.conwaylife.com/wiki/Plaintext
+//   .rle   - run length encoded, see: www.conwaylife.com/wiki/Run_Length_Encoded
+//
+// Like compile_pattern.py, offset_x shifts the pattern along its lines
+// (the second matrix index), and offset_y shifts it across lines (the first).
+// Cells that fall outside the board are dropped.
+//
+
+//
+// Function Declarations
+//
+
+// Return whether the file is a pattern file (rather than a raw board)
+int gol_is_pattern_file(const char* file_path);
+// Create a simulation of an n*n board with the pattern at the given offset.
+// Return NULL if the file can't be read or is malformed (see gol_create_simulation).
+Simulation* gol_create_simulation_from_pattern(const char* file_path, int n, int offset_x, int offset_y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOL_PATTERN_H_ */
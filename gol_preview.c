@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <error.h>
+#include <pthread.h>
+#include "common.h"
+#include "gol_preview.h"
+#include "gol_trace.h"
+
+//
+// Constants
+//
+
+// Number of previews which may be queued (or being written) at once
+#define PREVIEW_BUFFERS 2
+#define FILE_NAME_LENGTH 256
+// The largest sample value of a PGM file
+#define PGM_MAX_VALUE 65535
+
+//
+// Structs
+//
+
+// The buffers are a ring: pending_count buffers from first_pending were
+// submitted and aren't written yet, and the one after them is filled next.
+struct PreviewWriter_t
+{
+	char* file_format;
+	int width;
+	int height;
+	int interval;
+	uint64_t max_count; // The number of cells in the largest block
+	int* buffers[PREVIEW_BUFFERS];
+	int generations[PREVIEW_BUFFERS];
+	int first_pending;
+	int pending_count;
+	bool should_writer_continue;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	// Signaled whenever a preview is submitted or written
+	// (only one of the threads may be waiting at a time)
+	pthread_cond_t changed_cond;
+};
+
+//
+// Function Declarations
+//
+
+static void* write_previews(void* arg);
+static void write_preview(const PreviewWriter* writer, const int* counts, int generation);
+static uint64_t get_max_count(int n, int width, int height);
+
+//
+// Implementation
+//
+
+int gol_can_preview(int n, int width, int height)
+{
+	return 1 <= width && width <= n && 1 <= height && height <= n
+			&& get_max_count(n, width, height) <= INT_MAX;
+}
+
+PreviewWriter* gol_create_preview_writer(const char* file_format, int n, int width, int height, int interval)
+{
+	VERIFY(gol_can_preview(n, width, height), "preview size isn't supported by the board");
+	assert(interval >= 1);
+	PreviewWriter* writer = (PreviewWriter*)malloc(sizeof(*writer));
+	VERIFY(writer != NULL, "malloc preview writer failed");
+	writer->file_format = strdup(file_format);
+	VERIFY(writer->file_format != NULL, "strdup failed");
+	writer->width = width;
+	writer->height = height;
+	writer->interval = interval;
+	writer->max_count = get_max_count(n, width, height);
+	int i;
+	for (i = 0; i < PREVIEW_BUFFERS; ++i)
+	{
+		writer->buffers[i] = (int*)malloc(sizeof(int) * width * height);
+		VERIFY(writer->buffers[i] != NULL, "malloc preview buffer failed");
+		writer->generations[i] = 0;
+	}
+	writer->first_pending = 0;
+	writer->pending_count = 0;
+	writer->should_writer_continue = TRUE;
+	PCHECK(pthread_mutex_init(&writer->mutex, NULL), "init mutex failed");
+	PCHECK(pthread_cond_init(&writer->changed_cond, NULL), "init condition variable failed");
+	PCHECK(pthread_create(&writer->thread, NULL, write_previews, writer), "create thread failed");
+	return writer;
+}
+
+void gol_destroy_preview_writer(PreviewWriter* writer)
+{
+	// Note: the writer thread writes the pending previews before it finishes
+	PCHECK(pthread_mutex_lock(&writer->mutex), "lock mutex failed");
+	writer->should_writer_continue = FALSE;
+	PCHECK(pthread_cond_signal(&writer->changed_cond), "condition signal failed");
+	PCHECK(pthread_mutex_unlock(&writer->mutex), "unlock mutex failed");
+	PCHECK(pthread_join(writer->thread, NULL), "thread join failed");
+
+	PCHECK(pthread_cond_destroy(&writer->changed_cond), "destroy condition variable failed");
+	PCHECK(pthread_mutex_destroy(&writer->mutex), "destroy mutex failed");
+	int i;
+	for (i = 0; i < PREVIEW_BUFFERS; ++i)
+	{
+		free(writer->buffers[i]);
+	}
+	free(writer->file_format);
+	free(writer);
+}
+
+int gol_get_preview_width(const PreviewWriter* writer)
+{
+	return writer->width;
+}
+
+int gol_get_preview_height(const PreviewWriter* writer)
+{
+	return writer->height;
+}
+
+int gol_get_preview_interval(const PreviewWriter* writer)
+{
+	return writer->interval;
+}
+
+int* gol_get_preview_buffer(PreviewWriter* writer)
+{
+	PCHECK(pthread_mutex_lock(&writer->mutex), "lock mutex failed");
+	if (writer->pending_count == PREVIEW_BUFFERS) {
+		uint64_t span_start = gol_begin_span();
+		while (writer->pending_count == PREVIEW_BUFFERS)
+		{
+			PCHECK(pthread_cond_wait(&writer->changed_cond, &writer->mutex), "wait on condition variable failed");
+		}
+		gol_end_span("preview wait", span_start);
+	}
+	int* buffer = writer->buffers[(writer->first_pending + writer->pending_count) % PREVIEW_BUFFERS];
+	PCHECK(pthread_mutex_unlock(&writer->mutex), "unlock mutex failed");
+	return buffer;
+}
+
+void gol_submit_preview(PreviewWriter* writer, int generation)
+{
+	PCHECK(pthread_mutex_lock(&writer->mutex), "lock mutex failed");
+	assert(writer->pending_count < PREVIEW_BUFFERS);
+	writer->generations[(writer->first_pending + writer->pending_count) % PREVIEW_BUFFERS] = generation;
+	writer->pending_count += 1;
+	PCHECK(pthread_cond_signal(&writer->changed_cond), "condition signal failed");
+	PCHECK(pthread_mutex_unlock(&writer->mutex), "unlock mutex failed");
+}
+
+static void* write_previews(void* arg)
+{
+	PreviewWriter* writer = (PreviewWriter*)arg;
+	gol_set_trace_thread_name("preview writer");
+	PCHECK(pthread_mutex_lock(&writer->mutex), "lock mutex failed");
+	while (TRUE)
+	{
+		while (writer->pending_count == 0 && writer->should_writer_continue)
+		{
+			PCHECK(pthread_cond_wait(&writer->changed_cond, &writer->mutex), "wait on condition variable failed");
+		}
+		if (writer->pending_count == 0) {
+			break;
+		}
+		const int* counts = writer->buffers[writer->first_pending];
+		int generation = writer->generations[writer->first_pending];
+		// Note: the buffer isn't reused until it's released below, so it's written unlocked
+		PCHECK(pthread_mutex_unlock(&writer->mutex), "unlock mutex failed");
+		write_preview(writer, counts, generation);
+		PCHECK(pthread_mutex_lock(&writer->mutex), "lock mutex failed");
+
+		writer->first_pending = (writer->first_pending + 1) % PREVIEW_BUFFERS;
+		writer->pending_count -= 1;
+		PCHECK(pthread_cond_signal(&writer->changed_cond), "condition signal failed");
+	}
+	PCHECK(pthread_mutex_unlock(&writer->mutex), "unlock mutex failed");
+	return NULL;
+}
+
+// Write a binary PGM file, whose samples are the counts.
+// Samples are a single byte if they fit in it, and otherwise two bytes (big endian),
+// so counts of blocks larger than PGM_MAX_VALUE cells are scaled down.
+// Note: see: netpbm.sourceforge.net/doc/pgm.html
+static void write_preview(const PreviewWriter* writer, const int* counts, int generation)
+{
+	uint64_t span_start = gol_begin_span();
+	char file_path[FILE_NAME_LENGTH];
+	snprintf(file_path, sizeof(file_path), writer->file_format, generation);
+	FILE* file = fopen(file_path, "wb");
+	VERIFY(file != NULL, "open preview file failed");
+
+	int max_value = writer->max_count < PGM_MAX_VALUE ? writer->max_count : PGM_MAX_VALUE;
+	int sample_size = max_value < 256 ? 1 : 2;
+	fprintf(file, "P5\n%d %d\n%d\n", writer->width, writer->height, max_value);
+	unsigned char* row = (unsigned char*)malloc(writer->width * sample_size);
+	VERIFY(row != NULL, "malloc preview row failed");
+	int x, y;
+	for (x = 0; x < writer->height; ++x)
+	{
+		for (y = 0; y < writer->width; ++y)
+		{
+			uint64_t value = counts[x * writer->width + y];
+			if (writer->max_count > PGM_MAX_VALUE) {
+				value = value * PGM_MAX_VALUE / writer->max_count;
+			}
+			if (sample_size == 1) {
+				row[y] = value;
+			} else {
+				row[2 * y] = value >> 8;
+				row[2 * y + 1] = value & 0xFF;
+			}
+		}
+		VERIFY(fwrite(row, sample_size, writer->width, file) == (size_t)writer->width, "write to preview file failed");
+	}
+	free(row);
+
+	VERIFY(fclose(file) == 0, "close preview file failed");
+	gol_end_span("write preview", span_start);
+}
+
+// Return the number of cells in the largest block of a preview.
+// Note: blocks are (n / height) or (n / height + 1) rows, and so are their columns
+static uint64_t get_max_count(int n, int width, int height)
+{
+	return (uint64_t)((n + height - 1) / height) * ((n + width - 1) / width);
+}
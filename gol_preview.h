@@ -0,0 +1,50 @@
+#ifndef GOL_PREVIEW_H_
+#define GOL_PREVIEW_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Preview images writer.
+//
+// A preview is a downsampled image of the board, where each pixel is the number
+// of alive cells in its block of the board (so it's a density map).
+// The pixels are counted by the engine during a step (see gol_request_preview),
+// and written to PGM files by the writer's own thread, so the simulation
+// doesn't wait for the disk.
+//
+
+//
+// Structs
+//
+
+typedef struct PreviewWriter_t PreviewWriter;
+
+//
+// Function Declarations
+//
+
+// Return whether width*height previews of an n*n board are supported: the preview must
+// fit on the board, and its blocks can't have more than INT_MAX cells (pixels are int counts)
+int gol_can_preview(int n, int width, int height);
+// Create a writer of width*height previews of an n*n board, taken every interval generations
+// (see gol_can_preview).
+// The file of each preview is named by file_format, a printf format of its generation.
+PreviewWriter* gol_create_preview_writer(const char* file_format, int n, int width, int height, int interval);
+// Wait until all the submitted previews are written, and destroy the writer
+void gol_destroy_preview_writer(PreviewWriter* writer);
+int gol_get_preview_width(const PreviewWriter* writer);
+int gol_get_preview_height(const PreviewWriter* writer);
+int gol_get_preview_interval(const PreviewWriter* writer);
+// Return a buffer for the pixels of the next preview (width*height counts, row after row).
+// If all the buffers are still being written, this waits for one of them.
+int* gol_get_preview_buffer(PreviewWriter* writer);
+// Queue the buffer returned by gol_get_preview_buffer to be written, as the preview of generation
+void gol_submit_preview(PreviewWriter* writer, int generation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOL_PREVIEW_H_ */
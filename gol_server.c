@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <error.h>
+#include <pthread.h>
+#include "common.h"
+#include "gol_server.h"
+
+//
+// Constants
+//
+
+// Largest accepted board dimension (n*n must fit in an int)
+#define MAX_BOARD_SIZE (32 * KILO)
+#define LISTEN_BACKLOG 16
+// Largest number of connections handled at once (each one by its own thread).
+// Further clients wait in the listen backlog until a connection is closed.
+#define MAX_CONNECTIONS 64
+// A client that sends (or reads) nothing for this long is disconnected,
+// so an idle client can't hold a job slot indefinitely.
+#define CONNECTION_TIMEOUT_SECONDS 5
+
+//
+// Structs
+//
+
+typedef struct CachedBoard_t
+{
+	char* file_path; // NULL if the entry is unused
+	// The file's identity when it was read, so a changed file is read again
+	// (the modification time alone has a coarse granularity on some file systems)
+	dev_t device;
+	ino_t inode;
+	off_t file_size;
+	struct timespec modification_time;
+	int n;
+	char* cells;
+	int users; // Jobs currently copying the cells (the entry can't be evicted)
+	unsigned long last_use;
+} CachedBoard;
+
+typedef struct Server_t
+{
+	WorkerPool* pool;
+	int max_jobs;
+
+	// Everything below is protected by mutex
+	pthread_mutex_t mutex;
+	pthread_cond_t job_finished_cond;
+	int active_jobs;
+	pthread_cond_t connection_closed_cond;
+	int connections_count;
+	// Simulations of finished jobs, kept for reuse (at most max_jobs)
+	Simulation** idle_simulations;
+	int idle_simulations_count;
+	CachedBoard boards[BOARD_CACHE_SIZE];
+	unsigned long use_counter;
+} Server;
+
+typedef struct Connection_t
+{
+	Server* server;
+	int fd;
+} Connection;
+
+//
+// Function Declarations
+//
+
+static void* handle_connection(void* arg);
+static void run_job(Server* server, FILE* in, FILE* out);
+static void admit_job(Server* server);
+static void finish_job(Server* server);
+static void reserve_connection(Server* server);
+static void release_connection(Server* server);
+static Simulation* take_simulation(Server* server, int n);
+static void give_back_simulation(Server* server, Simulation* simulation);
+static CachedBoard* acquire_board(Server* server, const char* file_path);
+static void release_board(Server* server, CachedBoard* board);
+static bool is_same_file_version(const CachedBoard* board, const struct stat* file_stat);
+
+//
+// Implementation
+//
+
+void gol_serve(const char* socket_path, WorkerPool* pool, int max_jobs)
+{
+	assert(max_jobs >= 1);
+	Server server;
+	server.pool = pool;
+	server.max_jobs = max_jobs;
+	PCHECK(pthread_mutex_init(&server.mutex, NULL), "init mutex failed");
+	PCHECK(pthread_cond_init(&server.job_finished_cond, NULL), "init condition variable failed");
+	server.active_jobs = 0;
+	PCHECK(pthread_cond_init(&server.connection_closed_cond, NULL), "init condition variable failed");
+	server.connections_count = 0;
+	server.idle_simulations = (Simulation**)malloc(sizeof(Simulation*) * max_jobs);
+	VERIFY(server.idle_simulations != NULL, "malloc idle simulations failed");
+	server.idle_simulations_count = 0;
+	memset(server.boards, 0, sizeof(server.boards));
+	server.use_counter = 0;
+
+	// A client that disconnects mid job shouldn't kill the server
+	VERIFY(signal(SIGPIPE, SIG_IGN) != SIG_ERR, "ignore SIGPIPE failed");
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	VERIFY(strlen(socket_path) < sizeof(address.sun_path), "socket path is too long");
+	strcpy(address.sun_path, socket_path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	VERIFY(listen_fd != -1, "create socket failed");
+	// Remove a stale socket of a previous server
+	unlink(socket_path);
+	VERIFY(bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) == 0, "bind socket failed");
+	VERIFY(listen(listen_fd, LISTEN_BACKLOG) == 0, "listen on socket failed");
+
+	while (TRUE)
+	{
+		reserve_connection(&server);
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1) {
+			VERIFY(errno == EINTR || errno == ECONNABORTED, "accept connection failed");
+			release_connection(&server);
+			continue;
+		}
+		Connection* connection = (Connection*)malloc(sizeof(*connection));
+		VERIFY(connection != NULL, "malloc connection failed");
+		connection->server = &server;
+		connection->fd = fd;
+		pthread_t thread;
+		PCHECK(pthread_create(&thread, NULL, handle_connection, connection), "create thread failed");
+		PCHECK(pthread_detach(thread), "detach thread failed");
+	}
+}
+
+static void* handle_connection(void* arg)
+{
+	Connection* connection = (Connection*)arg;
+	// Note: the timeouts are of the socket, so they apply to the dup'ed fd too
+	struct timeval timeout = {CONNECTION_TIMEOUT_SECONDS, 0};
+	VERIFY(setsockopt(connection->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0, "set receive timeout failed");
+	VERIFY(setsockopt(connection->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0, "set send timeout failed");
+	int out_fd = dup(connection->fd);
+	VERIFY(out_fd != -1, "dup connection failed");
+	FILE* in = fdopen(connection->fd, "r");
+	VERIFY(in != NULL, "fdopen connection failed");
+	FILE* out = fdopen(out_fd, "w");
+	VERIFY(out != NULL, "fdopen connection failed");
+
+	run_job(connection->server, in, out);
+
+	// Note: errors here mean that the client went away, there's nobody to report to.
+	fclose(out);
+	fclose(in);
+	release_connection(connection->server);
+	free(connection);
+	return NULL;
+}
+
+static void run_job(Server* server, FILE* in, FILE* out)
+{
+	char line[PATH_MAX + 64];
+	if (fgets(line, sizeof(line), in) == NULL) {
+		return;
+	}
+	char kind[16];
+	char argument[PATH_MAX];
+	char flag[16] = "";
+	int steps;
+	int fields = sscanf(line, "%15s %4095s %d %15s", kind, argument, &steps, flag);
+	bool should_gather_stats = fields == 4 && strcmp(flag, "stats") == 0;
+	if (fields < 3 || (fields == 4 && !should_gather_stats) || steps < 0) {
+		fprintf(out, "error invalid request\n");
+		return;
+	}
+
+	bool is_inline_board = strcmp(kind, "board") == 0;
+	int n = 0;
+	if (is_inline_board) {
+		errno = 0;
+		n = strtol(argument, NULL, 0);
+	} else if (strcmp(kind, "file") != 0) {
+		fprintf(out, "error unknown request %s\n", kind);
+		return;
+	}
+	if (is_inline_board && (errno != 0 || !gol_can_step_in_pool(n) || n > MAX_BOARD_SIZE)) {
+		fprintf(out, "error board size should be a power of 2 up to %d\n", MAX_BOARD_SIZE);
+		return;
+	}
+
+	// Note: the job is admitted before its board is read, so at most max_jobs
+	// boards are in memory at once (however many clients are connected).
+	// A client that stops sending its board times out, which frees its slot.
+	admit_job(server);
+
+	// Get the initial board, either from the request or from the board cache
+	char* cells = NULL;
+	CachedBoard* board = NULL;
+	Simulation* simulation = NULL;
+	if (is_inline_board) {
+		cells = (char*)malloc(n * n);
+		if (cells == NULL) {
+			fprintf(out, "error can't allocate a %d*%d board\n", n, n);
+			goto out;
+		}
+		if (fread(cells, 1, n * n, in) != (size_t)(n * n)) {
+			// Note: this is also where a client that stopped sending times out
+			fprintf(out, "error board ended prematurely\n");
+			goto out;
+		}
+	} else {
+		board = acquire_board(server, argument);
+		if (board == NULL) {
+			fprintf(out, "error can't read board file %s\n", argument);
+			goto out;
+		}
+		n = board->n;
+		cells = board->cells;
+		if (!gol_can_step_in_pool(n)) {
+			fprintf(out, "error board size should be a power of 2 up to %d\n", MAX_BOARD_SIZE);
+			goto out;
+		}
+	}
+
+	simulation = take_simulation(server, n);
+	if (simulation == NULL) {
+		fprintf(out, "error can't allocate a %d*%d board\n", n, n);
+		goto out;
+	}
+	gol_import_cells(simulation, cells);
+	if (board != NULL) {
+		release_board(server, board);
+		board = NULL;
+	}
+
+	// Start time measurement
+	uint64_t start = gol_get_time_ns();
+
+	Stats stats;
+	bool is_stepped = TRUE;
+	bool is_client_reading = TRUE;
+	int i;
+	for (i = 0; i < steps && is_stepped && is_client_reading; ++i)
+	{
+		is_stepped = gol_simulate_step(simulation, server->pool, should_gather_stats ? &stats : NULL);
+		if (is_stepped && should_gather_stats) {
+			fprintf(out, "stats ");
+			gol_write_stats(out, gol_get_generation(simulation), &stats);
+			// Note: the connection is fully buffered, so each line is flushed as it's written.
+			// A client that stops reading times out here, and its job is dropped.
+			is_client_reading = fflush(out) == 0;
+		}
+	}
+	if (!is_stepped || !is_client_reading) {
+		give_back_simulation(server, simulation);
+		if (!is_stepped) {
+			fprintf(out, "error simulation step failed\n");
+		}
+		goto out;
+	}
+
+	// End time measurement
+	unsigned long diff_milliseconds = (gol_get_time_ns() - start) / 1000000;
+
+	// Note: the cells buffer of an inline board is reused for the result
+	if (!is_inline_board) {
+		cells = (char*)malloc(n * n);
+		VERIFY(cells != NULL, "malloc board failed");
+	}
+	gol_export_cells(simulation, cells);
+	give_back_simulation(server, simulation);
+	finish_job(server);
+
+	fprintf(out, "done %d %lu\n", n, diff_milliseconds);
+	fwrite(cells, 1, n * n, out);
+	free(cells);
+	return;
+
+out:
+	if (board != NULL) {
+		release_board(server, board);
+	} else {
+		free(cells);
+	}
+	finish_job(server);
+}
+
+// Wait until there are less than max_jobs jobs being simulated.
+// The workers of the pool are shared by all the jobs, so admitting
+// more jobs wouldn't make them any faster, only use more memory.
+static void admit_job(Server* server)
+{
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	while (server->active_jobs == server->max_jobs)
+	{
+		PCHECK(pthread_cond_wait(&server->job_finished_cond, &server->mutex), "wait on condition variable failed");
+	}
+	server->active_jobs += 1;
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+}
+
+static void finish_job(Server* server)
+{
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	server->active_jobs -= 1;
+	PCHECK(pthread_cond_signal(&server->job_finished_cond), "condition signal failed");
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+}
+
+// Wait until there are less than MAX_CONNECTIONS connections, and reserve one.
+// This bounds the server's threads, whatever the number of clients.
+static void reserve_connection(Server* server)
+{
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	while (server->connections_count == MAX_CONNECTIONS)
+	{
+		PCHECK(pthread_cond_wait(&server->connection_closed_cond, &server->mutex), "wait on condition variable failed");
+	}
+	server->connections_count += 1;
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+}
+
+static void release_connection(Server* server)
+{
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	server->connections_count -= 1;
+	PCHECK(pthread_cond_signal(&server->connection_closed_cond), "condition signal failed");
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+}
+
+// Reuse an idle simulation of the right size if there is one,
+// else create a new one (NULL if it can't be allocated).
+static Simulation* take_simulation(Server* server, int n)
+{
+	Simulation* simulation = NULL;
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	int i;
+	for (i = 0; i < server->idle_simulations_count; ++i)
+	{
+		if (gol_get_size(server->idle_simulations[i]) == n) {
+			simulation = server->idle_simulations[i];
+			server->idle_simulations_count -= 1;
+			server->idle_simulations[i] = server->idle_simulations[server->idle_simulations_count];
+			break;
+		}
+	}
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+
+	if (simulation == NULL) {
+		simulation = gol_create_simulation(n);
+	}
+	return simulation;
+}
+
+static void give_back_simulation(Server* server, Simulation* simulation)
+{
+	Simulation* evicted = NULL;
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	if (server->idle_simulations_count == server->max_jobs) {
+		// Evict the oldest idle simulation
+		evicted = server->idle_simulations[0];
+		memmove(&server->idle_simulations[0], &server->idle_simulations[1],
+				sizeof(Simulation*) * (server->idle_simulations_count - 1));
+		server->idle_simulations_count -= 1;
+	}
+	server->idle_simulations[server->idle_simulations_count] = simulation;
+	server->idle_simulations_count += 1;
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+
+	if (evicted != NULL) {
+		gol_destroy_simulation(evicted);
+	}
+}
+
+// Get the board of a file from the cache, reading it if it isn't cached
+// or if the file changed since it was cached.
+// Returns NULL if the file can't be read, or its board is larger than MAX_BOARD_SIZE.
+static CachedBoard* acquire_board(Server* server, const char* file_path)
+{
+	struct stat file_stat;
+	if (stat(file_path, &file_stat) != 0 || file_stat.st_size > (off_t)MAX_BOARD_SIZE * MAX_BOARD_SIZE) {
+		return NULL;
+	}
+
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	int i;
+	for (i = 0; i < BOARD_CACHE_SIZE; ++i)
+	{
+		CachedBoard* board = &server->boards[i];
+		if (board->file_path != NULL
+				&& strcmp(board->file_path, file_path) == 0
+				&& is_same_file_version(board, &file_stat)) {
+			board->users += 1;
+			board->last_use = ++server->use_counter;
+			PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+			return board;
+		}
+	}
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+
+	// Note: the file is read without holding the lock, so other jobs aren't held up.
+	// Note: if the file changes while it's read, its next job sees a new
+	// modification time, and reads it again.
+	int n;
+	char* cells = gol_read_board_file(file_path, &n);
+	if (cells == NULL) {
+		return NULL;
+	}
+
+	// Replace the least recently used entry which isn't in use
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	CachedBoard* board = NULL;
+	for (i = 0; i < BOARD_CACHE_SIZE; ++i)
+	{
+		CachedBoard* candidate = &server->boards[i];
+		if (candidate->users == 0 && (board == NULL || candidate->last_use < board->last_use)) {
+			board = candidate;
+		}
+	}
+	if (board == NULL) {
+		// All the entries are in use, so this board won't be cached
+		PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+		board = (CachedBoard*)malloc(sizeof(*board));
+		VERIFY(board != NULL, "malloc board failed");
+		board->file_path = NULL;
+		board->n = n;
+		board->cells = cells;
+		board->users = 1;
+		return board;
+	}
+	free(board->file_path);
+	free(board->cells);
+	board->file_path = strdup(file_path);
+	VERIFY(board->file_path != NULL, "strdup failed");
+	board->device = file_stat.st_dev;
+	board->inode = file_stat.st_ino;
+	board->file_size = file_stat.st_size;
+	board->modification_time = file_stat.st_mtim;
+	board->n = n;
+	board->cells = cells;
+	board->users = 1;
+	board->last_use = ++server->use_counter;
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+	return board;
+}
+
+static void release_board(Server* server, CachedBoard* board)
+{
+	if (board->file_path == NULL) {
+		// Not cached, see acquire_board
+		free(board->cells);
+		free(board);
+		return;
+	}
+	PCHECK(pthread_mutex_lock(&server->mutex), "lock mutex failed");
+	board->users -= 1;
+	PCHECK(pthread_mutex_unlock(&server->mutex), "unlock mutex failed");
+}
+
+static bool is_same_file_version(const CachedBoard* board, const struct stat* file_stat)
+{
+	return board->device == file_stat->st_dev
+			&& board->inode == file_stat->st_ino
+			&& board->file_size == file_stat->st_size
+			&& board->modification_time.tv_sec == file_stat->st_mtim.tv_sec
+			&& board->modification_time.tv_nsec == file_stat->st_mtim.tv_nsec;
+}
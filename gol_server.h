@@ -0,0 +1,52 @@
+#ifndef GOL_SERVER_H_
+#define GOL_SERVER_H_
+
+#include "gol_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Simulation server.
+//
+// Jobs are accepted over a unix domain socket, one job per connection.
+// A job is a single request line, optionally followed by a board:
+//
+//   board <n> <steps> [stats]\n<n*n bytes of cells>
+//   file <path> <steps> [stats]\n
+//
+// The board of a "file" job is read on the server side, and recently read
+// boards are cached. With "stats", a "stats <line>\n" line (in the format of
+// gol_write_stats) is streamed back per generation. The response ends with:
+//
+//   done <n> <milliseconds>\n<n*n bytes of cells>
+//
+// or with "error <message>\n" if the job was rejected.
+//
+// All jobs are simulated by the same (warm) worker pool, and the matrices
+// of finished jobs are kept for reuse by later jobs of the same size.
+// At most max_jobs jobs are simulated at once, the rest wait for their turn
+// (before their boards are read, so waiting jobs don't hold boards in memory).
+// A client that sends or reads nothing for a few seconds is disconnected,
+// and its job (if any) is dropped, so idle clients can't hold job slots.
+//
+
+//
+// Constants
+//
+
+#define BOARD_CACHE_SIZE 4
+
+//
+// Function Declarations
+//
+
+// Serve jobs on socket_path forever
+void gol_serve(const char* socket_path, WorkerPool* pool, int max_jobs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOL_SERVER_H_ */
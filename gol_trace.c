@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <error.h>
+#include <pthread.h>
+#include "common.h"
+#include "gol_trace.h"
+
+//
+// Constants
+//
+
+#define THREAD_NAME_LENGTH 32
+#define INITIAL_TRACE_EVENTS (16 * KILO)
+// Events recorded per thread (24 bytes each), so tracing a long simulation of a
+// large board (a span per leaf) can't run out of memory. Later events are dropped,
+// and the trace says so.
+#define MAX_TRACE_EVENTS (MEGA)
+
+//
+// Structs
+//
+
+typedef struct TraceEvent_t
+{
+	const char* name;
+	uint64_t start;
+	uint64_t duration;
+} TraceEvent;
+
+// The events of a single thread (so recording events needs no locking)
+typedef struct TraceBuffer_t
+{
+	char thread_name[THREAD_NAME_LENGTH];
+	int thread_id;
+	TraceEvent* events;
+	int events_count;
+	int capacity;
+	long dropped_events_count;
+	uint64_t first_drop_time; // When the first event was dropped (if any)
+	struct TraceBuffer_t* next;
+} TraceBuffer;
+
+//
+// Globals
+//
+
+static bool is_tracing = FALSE;
+static char* trace_path = NULL;
+static uint64_t trace_start_time = 0;
+// Incremented by each gol_start_trace, so threads notice their buffer is stale
+static int trace_session = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer* trace_buffers = NULL;
+static int trace_buffers_count = 0;
+
+static __thread TraceBuffer* thread_buffer = NULL;
+static __thread int thread_buffer_session = 0;
+static __thread char thread_name[THREAD_NAME_LENGTH] = "";
+
+//
+// Function Declarations
+//
+
+static int get_bucket_index(uint64_t value);
+static uint64_t get_bucket_value(int index);
+static TraceBuffer* get_thread_buffer();
+static void write_trace(FILE* file);
+
+//
+// Implementation
+//
+
+uint64_t gol_get_time_ns()
+{
+	struct timespec now;
+	VERIFY(clock_gettime(CLOCK_MONOTONIC, &now) == 0, "Error getting time");
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void gol_reset_histogram(Histogram* histogram)
+{
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+void gol_record_value(Histogram* histogram, uint64_t value)
+{
+	histogram->counts[get_bucket_index(value)] += 1;
+	histogram->total_count += 1;
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+uint64_t gol_get_percentile(const Histogram* histogram, double percentile)
+{
+	unsigned long count_at_percentile = (unsigned long)(histogram->total_count * percentile / 100 + 0.5);
+	if (count_at_percentile == 0) {
+		count_at_percentile = 1;
+	}
+	unsigned long count = 0;
+	int i;
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i)
+	{
+		count += histogram->counts[i];
+		if (count >= count_at_percentile) {
+			uint64_t value = get_bucket_value(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+void gol_print_latency_summary(FILE* file, const char* title, const Histogram* histogram)
+{
+	if (histogram->total_count == 0) {
+		return;
+	}
+	fprintf(file, "%s (microseconds): p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", title,
+			gol_get_percentile(histogram, 50) / 1000.0,
+			gol_get_percentile(histogram, 90) / 1000.0,
+			gol_get_percentile(histogram, 99) / 1000.0,
+			histogram->max / 1000.0);
+}
+
+// Values below HISTOGRAM_SUB_BUCKETS have a bucket each. Above that,
+// the bucket is chosen by the position of the top bit, and by the bits below it.
+static int get_bucket_index(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_BUCKETS) {
+		return value;
+	}
+	int top_bit = 63 - __builtin_clzll(value);
+	int shift = top_bit - HISTOGRAM_SUB_BUCKET_BITS;
+	int sub_bucket = (value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+// Return the highest value of a bucket
+static uint64_t get_bucket_value(int index)
+{
+	if (index < HISTOGRAM_SUB_BUCKETS) {
+		return index;
+	}
+	int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub_bucket = index % HISTOGRAM_SUB_BUCKETS;
+	return ((HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+void gol_start_trace(const char* file_path)
+{
+	PCHECK(pthread_mutex_lock(&trace_mutex), "lock mutex failed");
+	assert(!is_tracing);
+	trace_path = strdup(file_path);
+	VERIFY(trace_path != NULL, "strdup failed");
+	trace_start_time = gol_get_time_ns();
+	trace_session += 1;
+	is_tracing = TRUE;
+	PCHECK(pthread_mutex_unlock(&trace_mutex), "unlock mutex failed");
+}
+
+// Note: threads must not record spans while (or after) the trace is stopped
+void gol_stop_trace()
+{
+	PCHECK(pthread_mutex_lock(&trace_mutex), "lock mutex failed");
+	if (!is_tracing) {
+		PCHECK(pthread_mutex_unlock(&trace_mutex), "unlock mutex failed");
+		return;
+	}
+	is_tracing = FALSE;
+
+	FILE* file = fopen(trace_path, "w");
+	VERIFY(file != NULL, "open trace file failed");
+	write_trace(file);
+	VERIFY(fclose(file) == 0, "close trace file failed");
+
+	long dropped_events_count = 0;
+	while (trace_buffers != NULL)
+	{
+		TraceBuffer* buffer = trace_buffers;
+		trace_buffers = buffer->next;
+		dropped_events_count += buffer->dropped_events_count;
+		free(buffer->events);
+		free(buffer);
+	}
+	if (dropped_events_count > 0) {
+		fprintf(stderr, "Warning: %ld trace events were dropped (a thread records up to %d events)\n",
+				dropped_events_count, MAX_TRACE_EVENTS);
+	}
+	trace_buffers_count = 0;
+	free(trace_path);
+	trace_path = NULL;
+	PCHECK(pthread_mutex_unlock(&trace_mutex), "unlock mutex failed");
+}
+
+void gol_set_trace_thread_name(const char* name)
+{
+	strncpy(thread_name, name, THREAD_NAME_LENGTH - 1);
+	if (thread_buffer != NULL && thread_buffer_session == trace_session) {
+		strcpy(thread_buffer->thread_name, thread_name);
+	}
+}
+
+uint64_t gol_begin_span()
+{
+	return is_tracing ? gol_get_time_ns() : 0;
+}
+
+void gol_end_span(const char* name, uint64_t start)
+{
+	if (!is_tracing || start == 0) {
+		return;
+	}
+	uint64_t end = gol_get_time_ns();
+	TraceBuffer* buffer = get_thread_buffer();
+	if (buffer->events_count == buffer->capacity) {
+		// Note: the events are dropped (rather than exiting) if the buffer can't grow either
+		TraceEvent* events = NULL;
+		if (buffer->capacity < MAX_TRACE_EVENTS) {
+			events = (TraceEvent*)realloc(buffer->events, sizeof(TraceEvent) * buffer->capacity * 2);
+		}
+		if (events == NULL) {
+			if (buffer->dropped_events_count == 0) {
+				buffer->first_drop_time = start;
+			}
+			buffer->dropped_events_count += 1;
+			return;
+		}
+		buffer->events = events;
+		buffer->capacity *= 2;
+	}
+	TraceEvent* event = &buffer->events[buffer->events_count];
+	event->name = name;
+	event->start = start;
+	event->duration = end - start;
+	buffer->events_count += 1;
+}
+
+static TraceBuffer* get_thread_buffer()
+{
+	if (thread_buffer != NULL && thread_buffer_session == trace_session) {
+		return thread_buffer;
+	}
+	TraceBuffer* buffer = (TraceBuffer*)malloc(sizeof(*buffer));
+	VERIFY(buffer != NULL, "malloc trace buffer failed");
+	buffer->capacity = INITIAL_TRACE_EVENTS;
+	buffer->events = (TraceEvent*)malloc(sizeof(TraceEvent) * buffer->capacity);
+	VERIFY(buffer->events != NULL, "malloc trace events failed");
+	buffer->events_count = 0;
+	buffer->dropped_events_count = 0;
+	buffer->first_drop_time = 0;
+	strcpy(buffer->thread_name, thread_name);
+
+	PCHECK(pthread_mutex_lock(&trace_mutex), "lock mutex failed");
+	buffer->thread_id = trace_buffers_count;
+	trace_buffers_count += 1;
+	buffer->next = trace_buffers;
+	trace_buffers = buffer;
+	thread_buffer_session = trace_session;
+	PCHECK(pthread_mutex_unlock(&trace_mutex), "unlock mutex failed");
+
+	thread_buffer = buffer;
+	return buffer;
+}
+
+// Note: timestamps of the trace event format are in microseconds
+static void write_trace(FILE* file)
+{
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool is_first = TRUE;
+	TraceBuffer* buffer;
+	for (buffer = trace_buffers; buffer != NULL; buffer = buffer->next)
+	{
+		if (buffer->thread_name[0] != '\0') {
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+					is_first ? "" : ",\n", buffer->thread_id, buffer->thread_name);
+			is_first = FALSE;
+		}
+		int i;
+		for (i = 0; i < buffer->events_count; ++i)
+		{
+			const TraceEvent* event = &buffer->events[i];
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					is_first ? "" : ",\n", event->name, buffer->thread_id,
+					(event->start - trace_start_time) / 1000.0, event->duration / 1000.0);
+			is_first = FALSE;
+		}
+		// An instant event marks where the thread's events stop
+		if (buffer->dropped_events_count > 0) {
+			fprintf(file, "%s{\"name\":\"%ld events dropped\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+					"\"args\":{\"dropped_events\":%ld,\"max_events\":%d}}",
+					is_first ? "" : ",\n", buffer->dropped_events_count, buffer->thread_id,
+					(buffer->first_drop_time - trace_start_time) / 1000.0,
+					buffer->dropped_events_count, MAX_TRACE_EVENTS);
+			is_first = FALSE;
+		}
+	}
+	fprintf(file, "\n]}\n");
+}
@@ -0,0 +1,69 @@
+#ifndef GOL_TRACE_H_
+#define GOL_TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Timing utilities: a monotonic nanosecond clock, a latency histogram,
+// and a process wide tracer which writes Chrome's trace event format
+// (viewable in chrome://tracing or ui.perfetto.dev).
+//
+
+//
+// Constants
+//
+
+// Each power of 2 range of values is split into 2^HISTOGRAM_SUB_BUCKET_BITS
+// buckets, so recorded values are accurate up to 1/16 of their magnitude.
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+//
+// Structs
+//
+
+// A log-linear histogram (in the spirit of HdrHistogram)
+typedef struct Histogram_t
+{
+	unsigned long counts[HISTOGRAM_BUCKETS];
+	unsigned long total_count;
+	uint64_t max;
+} Histogram;
+
+//
+// Function Declarations
+//
+
+// Return the time of the monotonic clock in nanoseconds
+uint64_t gol_get_time_ns();
+
+void gol_reset_histogram(Histogram* histogram);
+void gol_record_value(Histogram* histogram, uint64_t value);
+// Return the (approximate) value below which percentile percent of the values are
+uint64_t gol_get_percentile(const Histogram* histogram, double percentile);
+// Print a one line summary of a histogram of nanosecond values
+void gol_print_latency_summary(FILE* file, const char* title, const Histogram* histogram);
+
+// Record trace events from now on, until gol_stop_trace writes them to file_path.
+// Each thread records a bounded number of events, later ones are dropped
+// (the trace marks where, and gol_stop_trace prints a warning).
+void gol_start_trace(const char* file_path);
+void gol_stop_trace();
+// Name the calling thread in the trace
+void gol_set_trace_thread_name(const char* name);
+// Return the start time of a span (or 0 when not tracing)
+uint64_t gol_begin_span();
+// Record a span (named by a string literal) of the calling thread, from start until now
+void gol_end_span(const char* name, uint64_t start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GOL_TRACE_H_ */
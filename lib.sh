@@ -0,0 +1,17 @@
+#!/bin/sh
+# Build the engine as a static library (libgol.a), to be used with
+# gol_engine.h (and gol_pattern.h, gol_preview.h, gol_server.h, gol_trace.h)
+# Note: plain sh, the objects are built in a temporary directory, which is removed on any exit
+SOURCES="gol_engine.c gol_pattern.c gol_preview.c gol_server.c gol_trace.c"
+
+OBJECTS_DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$OBJECTS_DIR"' EXIT
+
+OBJECTS=""
+for SOURCE in $SOURCES; do
+	OBJECT="$OBJECTS_DIR/${SOURCE%.c}.o"
+	gcc -c $SOURCE -o "$OBJECT" -pthread || exit 1
+	OBJECTS="$OBJECTS $OBJECT"
+done
+rm -f libgol.a
+ar rcs libgol.a $OBJECTS
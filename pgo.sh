@@ -3,6 +3,5 @@ STEPS=${1:-1}
 INPUT_MATRIX=${2:-glider8.bin}
 THREADS=${3:-1}
 
-gcc pgol.c -o pgol -pthread && ./pgol $INPUT_MATRIX $STEPS $THREADS
+gcc pgol.c gol_engine.c gol_pattern.c gol_preview.c gol_server.c gol_trace.c -o pgol -pthread && ./pgol $INPUT_MATRIX $STEPS $THREADS
 rm -f pgol
-